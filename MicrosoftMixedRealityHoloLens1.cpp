@@ -1,29 +1,337 @@
 using Microsoft.MixedReality.Toolkit;
+using Microsoft.MixedReality.Toolkit.SpatialAwareness;
 using Microsoft.Azure.CognitiveServices.Vision.ComputerVision;
 using UnityEngine;
+using UnityEngine.Experimental.Rendering;
+using TMPro;
 using System;
+using System.Buffers;
+using System.Threading;
 using System.Threading.Tasks;
 using System.IO;
 using System.Linq;
 using System.Collections.Generic;
+using System.Globalization;
+using System.Net.Http;
+using System.Net.Sockets;
+using System.IO.MemoryMappedFiles;
+using System.Runtime.InteropServices;
+using System.Runtime.ExceptionServices;
+using System.Security.Cryptography;
+using System.Diagnostics;
+using Debug = UnityEngine.Debug;
+#if ENABLE_WINMD_SUPPORT
+using System.Runtime.InteropServices.WindowsRuntime;
+using Windows.Media.Capture;
+using Windows.Media.Capture.Frames;
+using Windows.Media.MediaProperties;
+using Windows.Perception.Spatial;
+#endif
 
 public class BudgetHoloLensVision : MonoBehaviour, IDisposable
 {
-    private int monthlyTransactionCount = 0;
     private const int FREE_TIER_LIMIT = 5000;
     private const int MAX_RETRY_ATTEMPTS = 3;
     private const int CACHE_EXPIRATION_HOURS = 24;
+    private const int MAX_CACHE_ENTRIES = 20000;
+    private const long MAX_CACHE_BYTES = 32L * 1024 * 1024;
+    private const string PERSISTENT_CACHE_FILE = "detection-cache.bin";
+    private const string LOCAL_DETECTOR_FILE = "local-detector.tdq";
+    private const string BUDGET_STATE_FILE = "vision-budget.txt";
+    private const int HEDGE_MIN_SAMPLES = 20;
     
-    private ComputerVisionClient visionClient;
+    private static readonly IList<VisualFeatureTypes?> objectFeatures =
+        new List<VisualFeatureTypes?> { VisualFeatureTypes.Objects };
+    private static readonly IList<VisualFeatureTypes?> objectAndTagFeatures =
+        new List<VisualFeatureTypes?> { VisualFeatureTypes.Objects, VisualFeatureTypes.Tags };
+    private const int SCENE_GRID_WIDTH = 32;
+    private const int SCENE_GRID_HEIGHT = 24;
+    
+    // Perceptual keys let frames of the same scene that differ only by sensor
+    // noise share a cache entry; exact whole-frame keys are used otherwise.
+    [SerializeField] private bool usePerceptualCacheKeys = true;
+    
+    // Exact keys hash every byte of the frame. Murmur128 (MurmurHash3
+    // x64-128) is several times faster than SHA-256 and collides no more
+    // often on camera frames; nobody feeds this cache adversarial input.
+    // With overlapHashing the frame's key (tile keys, perceptual hash or
+    // exact key, whichever is in use) is computed on a worker as soon as the
+    // frame is captured, alongside the scene gate and tracker, and an exact
+    // hash is abandoned if either of them resolves the frame.
+    [SerializeField] private CacheKeyHash exactKeyHash = CacheKeyHash.Murmur128;
+    [SerializeField] private bool overlapHashing = true;
+    [SerializeField] private int perceptualHashMaxDistance = 6;
+    [SerializeField] private bool usePersistentCache = true;
+    
+    // Frames whose 32x24 luma thumbnail differs from the last displayed frame
+    // by less than this mean absolute difference (0-255) reuse its result.
+    [SerializeField] private bool useSceneChangeGate = true;
+    [SerializeField] private float sceneChangeThreshold = 4f;
+    [SerializeField] private bool useMockBackend = false;
+    
+    // Frames are downscaled to uploadLongEdge pixels on their longest side and
+    // compressed before upload. Raw uploads are only useful against the mock.
+    [SerializeField] private UploadEncoding uploadEncoding = UploadEncoding.Jpeg;
+    [SerializeField] private int uploadLongEdge = 1280;
+    [SerializeField, Range(1, 100)] private int uploadJpegQuality = 80;
+    
+    // Frames whose local detections all clear this confidence skip the cloud.
+    [SerializeField] private bool useLocalDetector = true;
+    [SerializeField, Range(0, 1)] private float localConfidenceThreshold = 0.6f;
+    
+    // Mosaic batching tiles up to mosaicMaxFrames cache misses, collected over
+    // mosaicWindowMilliseconds, into one image and one billed call.
+    [SerializeField] private bool useMosaicBatching = false;
+    [SerializeField] private int mosaicMaxFrames = 4;
+    [SerializeField] private int mosaicWindowMilliseconds = 250;
+    
+    // Tiled analysis splits each frame into a tileColumns x tileRows grid with
+    // its own cache entry per tile; only tiles that changed are packed and
+    // sent, so a person walking through one corner does not re-bill the room.
+    [SerializeField] private bool useTiledAnalysis = false;
+    [SerializeField, Range(1, 8)] private int tileColumns = 3;
+    [SerializeField, Range(1, 8)] private int tileRows = 3;
+    
+    // Remote calls are spread over the month: each day gets an equal share of
+    // what is left, and a per-minute bucket keeps bursts under the service's
+    // rate limit. Frames of low novelty may only spend the part of today's
+    // share above lowNoveltyReserve; frames below deferNovelty are dropped
+    // rather than waiting for the rate bucket.
+    [SerializeField] private int maxCallsPerMinute = 20;
+    [SerializeField, Range(0, 1)] private float lowNoveltyReserve = 0.8f;
+    [SerializeField, Range(0, 1)] private float deferNovelty = 0.5f;
+    [SerializeField] private float maxDeferSeconds = 5f;
+    
+    // Remote calls back off with decorrelated jitter between the base and max
+    // delay. Each attempt gets perCallTimeoutSeconds and the whole call,
+    // retries included, requestDeadlineSeconds. After breakerFailureThreshold
+    // consecutive failures the backend is skipped for breakerOpenSeconds and
+    // frames fall back to local or last-known results.
+    [SerializeField] private float retryBaseDelaySeconds = 0.2f;
+    [SerializeField] private float retryMaxDelaySeconds = 2f;
+    [SerializeField] private float perCallTimeoutSeconds = 3f;
+    [SerializeField] private float requestDeadlineSeconds = 6f;
+    [SerializeField] private int breakerFailureThreshold = 5;
+    [SerializeField] private float breakerOpenSeconds = 30f;
+    
+    // Image tags are only requested when a consumer reads them; nothing in
+    // this component does, and dropping them shrinks the response and the
+    // service's work per call. Mosaic and tiled uploads never request tags,
+    // since they cannot be attributed to one frame or tile.
+    [SerializeField] private bool requestTags = false;
+    
+    // A call still unanswered after the observed p95 latency is sent again and
+    // the first answer wins. Duplicates are billed, so they are capped at
+    // hedgeBudgetFraction of the monthly quota.
+    [SerializeField] private bool useHedgedRequests = false;
+    [SerializeField, Range(0, 0.2f)] private float hedgeBudgetFraction = 0.05f;
+    
+    // Between analyses, the boxes of the last analyzed result are tracked
+    // across frames for up to trackerMaxFrames frames; a frame goes on to
+    // hashing, cache and analysis once any track's confidence falls below
+    // trackerMinConfidence.
+    [SerializeField] private bool useTracking = true;
+    [SerializeField] private int trackerMaxFrames = 15;
+    [SerializeField, Range(0, 1)] private float trackerMinConfidence = 0.5f;
+    
+    // Labels are anchored where the ray through each box center, cast from
+    // the camera pose at capture, meets the spatial mesh (within
+    // maxAnchorDistance metres). The mesh is re-indexed every
+    // spatialMeshRefreshSeconds; rays that miss it, or frames captured before
+    // one exists, land fallbackAnchorDistance metres out.
+    [SerializeField] private bool useSpatialAnchoring = true;
+    [SerializeField] private float spatialMeshRefreshSeconds = 5f;
+    [SerializeField] private float maxAnchorDistance = 10f;
+    [SerializeField] private float fallbackAnchorDistance = 2f;
+    
+    // Video mode keeps the camera streaming into a ring of the last
+    // streamRingFrames frames, and capture hands the pipeline the newest one
+    // instead of waiting for a photo. It needs WinRT (a UWP build); elsewhere
+    // photo mode is used.
+    [SerializeField] private bool useVideoStream = true;
+    [SerializeField, Range(1, 16)] private int streamRingFrames = 4;
+    
+    // The capture resolution starts at the smallest that fills an upload and
+    // is re-picked every profileWindowFrames analyzed frames: smaller while
+    // end-to-end latency exceeds targetLatencyMilliseconds, larger again (up
+    // to that starting size, since uploads are capped at uploadLongEdge)
+    // while the mean confidence of analyzed detections is under
+    // targetConfidence.
+    // Video mode streams NV12, converting only the frames the pipeline takes;
+    // photo mode only delivers BGRA32.
+    [SerializeField] private bool autoTuneCapture = true;
+    [SerializeField] private float targetLatencyMilliseconds = 1500f;
+    [SerializeField, Range(0, 1)] private float targetConfidence = 0.6f;
+    [SerializeField] private int profileWindowFrames = 30;
+    
+    [SerializeField] private StageLimits captureLimits = new StageLimits(1, 1);
+    [SerializeField] private StageLimits sceneLimits = new StageLimits(1, 1);
+    [SerializeField] private StageLimits trackLimits = new StageLimits(1, 1);
+    [SerializeField] private StageLimits hashLimits = new StageLimits(2, 2);
+    [SerializeField] private StageLimits lookupLimits = new StageLimits(2, 1);
+    [SerializeField] private StageLimits localLimits = new StageLimits(1, 1);
+    [SerializeField] private StageLimits encodeLimits = new StageLimits(1, 1);
+    [SerializeField] private StageLimits analyzeLimits = new StageLimits(1, 2);
+    [SerializeField] private StageLimits projectLimits = new StageLimits(2, 1);
+    [SerializeField] private StageLimits labelLimits = new StageLimits(2, 1);
+    
+    private IVisionBackend visionBackend;
+    private Func<Task<(FrameBuffer Frame, CameraPose Pose, Resolution Resolution)>> captureFrame;
+    private readonly List<byte> captureScratch = new List<byte>();
     private PhotoCapture photoCaptureObject = null;
-    private bool isProcessing = false;
+    private IFrameStream frameStream;
+    private FrameRing frameRing;
+    private CaptureProfileSelector profileSelector;
+#if ENABLE_WINMD_SUPPORT
+    private SpatialCoordinateSystem worldOrigin;
+#endif
+    private LatencyRecorder captureLatency = new LatencyRecorder(256);
+    private Resolution cameraResolution;
     private bool isDisposed = false;
     
-    private Dictionary<string, DetectionResult> resultCache = new Dictionary<string, DetectionResult>();
+    private DetectionCache resultCache;
+    private BudgetScheduler budget;
+    private CircuitBreaker circuitBreaker;
+    private readonly System.Random retryJitter = new System.Random();
+    private readonly LatencyRecorder callLatency = new LatencyRecorder(256);
+    
+    // Frames submitted and not yet completed, in submission order. Dispose
+    // cancels all of them; a displayed frame cancels the older ones.
+    private readonly LinkedList<FrameJob> activeJobs = new LinkedList<FrameJob>();
+    private readonly CancellationTokenSource lifetime = new CancellationTokenSource();
+    private long nextFrameSequence;
+    private PerceptualHashIndex perceptualIndex = new PerceptualHashIndex();
+    private PersistentDetectionStore persistentStore;
+    private Task<Int8Detector> localDetectorLoad;
+    private MosaicBatcher mosaicBatcher;
+    private readonly LabelManager labels = new LabelManager();
+    private readonly ObjectTracker tracker = new ObjectTracker();
+    private SpatialMeshIndex spatialMesh;
+    private Task<SpatialMeshIndex> spatialMeshBuild;
+    private bool spatialMeshInjected;
+    private float nextSpatialMeshRefresh;
+    private bool persistentKeysIndexed = false;
+    
+    private PipelineStage captureStage;
+    private PipelineStage sceneStage;
+    private PipelineStage trackStage;
+    private PipelineStage hashStage;
+    private PipelineStage lookupStage;
+    private PipelineStage localStage;
+    private PipelineStage encodeStage;
+    private PipelineStage analyzeStage;
+    private PipelineStage projectStage;
+    private PipelineStage labelStage;
+    
+    public int CacheHits { get; private set; }
+    public int NearDuplicateCacheHits { get; private set; }
+    public int PersistentCacheHits { get; private set; }
+    public long UploadedBytes { get; private set; }
+    public int SceneGatedFrames { get; private set; }
+    public int SceneSkippedFrames { get; private set; }
+    public double SceneSkipRatio => SceneGatedFrames > 0 ? (double)SceneSkippedFrames / SceneGatedFrames : 0;
+    public double SceneDetectorMicroseconds => SceneGatedFrames > 0 ? sceneDetectorTicks * 1e6 / Stopwatch.Frequency / SceneGatedFrames : 0;
+    
+    private long sceneDetectorTicks;
+    private byte[] lastSceneThumbnail;
+    private DetectionResult lastSceneResult;
+    private DetectionResult lastDisplayedResult;
+    public int LocallyResolvedFrames { get; private set; }
+    public int RemoteCalls { get; private set; }
+    public int RemotelyAnalyzedFrames { get; private set; }
+    public int TileCacheHits { get; private set; }
+    public int BudgetDeferredFrames { get; private set; }
+    public int BudgetDeniedFrames { get; private set; }
+    public int TransactionsThisMonth => budget.UsedThisMonth;
+    public int RetryAttempts { get; private set; }
+    public int FailedFastCalls { get; private set; }
+    public int FallbackFrames { get; private set; }
+    public bool IsBackendCircuitOpen => circuitBreaker.IsOpen;
+    public int HedgedCalls { get; private set; }
+    public int HedgeWins { get; private set; }
+    public int HedgeCancellations { get; private set; }
+    public int HedgesThisMonth => budget.HedgesThisMonth;
+    public int CancelledFrames { get; private set; }
+    public int CancelledRequests { get; private set; }
+    public long BandwidthSavedBytes { get; private set; }
+    public int UploadedTiles { get; private set; }
+    public int ActiveLabels => labels.ActiveLabels;
+    public int CreatedLabels => labels.CreatedLabels;
+    // From shutter request (photo) or sensor timestamp (video) to the frame
+    // being handed to the pipeline.
+    public double CaptureLatencyP50Milliseconds => captureLatency.PercentileMilliseconds(50);
+    public double CaptureLatencyP99Milliseconds => captureLatency.PercentileMilliseconds(99);
+    public long SkippedStreamFrames => frameRing?.SkippedFrames ?? 0;
+    public bool IsVideoStreaming => frameStream != null;
+    public CaptureProfile CurrentCaptureProfile => profileSelector?.Current ??
+        new CaptureProfile(cameraResolution.width, cameraResolution.height, CapturePixelFormat.BGRA32);
+    public int CaptureProfileChanges { get; private set; }
+    public int TrackedFrames { get; private set; }
+    public int TrackerFrames { get; private set; }
+    public double TrackerMicroseconds => TrackerFrames > 0 ? trackerTicks * 1e6 / Stopwatch.Frequency / TrackerFrames : 0;
+    public int HashedFrames { get; private set; }
+    
+    // Time the hash stage spent waiting for a frame's key, i.e. what hashing
+    // still adds to a frame's latency after any overlap with the scene and
+    // track stages.
+    public double HashWaitMicroseconds => HashedFrames > 0 ? hashWaitTicks * 1e6 / Stopwatch.Frequency / HashedFrames : 0;
+    public int AnchoredDetections { get; private set; }
+    public int MeshAnchoredDetections { get; private set; }
+    public double AnchorMicroseconds => AnchoredDetections > 0 ? anchorTicks * 1e6 / Stopwatch.Frequency / AnchoredDetections : 0;
+    
+    private long anchorTicks;
+    private long trackerTicks;
+    private long hashWaitTicks;
+    private static long workerAllocatedBytes;
+    
+    private void Awake()
+    {
+        captureFrame = CaptureImage;
+        InitializePipeline();
+        resultCache = new DetectionCache(MAX_CACHE_ENTRIES, MAX_CACHE_BYTES, OnCacheEntryRemoved);
+        budget = new BudgetScheduler(
+            FREE_TIER_LIMIT,
+            maxCallsPerMinute,
+            lowNoveltyReserve,
+            Path.Combine(Application.persistentDataPath, BUDGET_STATE_FILE),
+            () => DateTime.Now);
+        circuitBreaker = new CircuitBreaker(breakerFailureThreshold, TimeSpan.FromSeconds(breakerOpenSeconds));
+        
+        if (usePersistentCache)
+        {
+            // The index is built in the background, so startup does not wait on the file.
+            persistentStore = new PersistentDetectionStore(
+                Path.Combine(Application.persistentDataPath, PERSISTENT_CACHE_FILE),
+                DateTime.Now.AddHours(-CACHE_EXPIRATION_HOURS));
+        }
+        
+        string detectorPath = Path.Combine(Application.persistentDataPath, LOCAL_DETECTOR_FILE);
+        if (useLocalDetector && File.Exists(detectorPath))
+        {
+            localDetectorLoad = Task.Run(() => Int8Detector.Load(detectorPath));
+        }
+    }
+    
+    // Labels are updated once per rendered frame, with the newest result.
+    private void LateUpdate()
+    {
+        labels.Apply();
+    }
     
     async void Start()
     {
-        InitializeVisionClient();
+        if (visionBackend == null)
+        {
+            if (useMockBackend)
+            {
+                visionBackend = new MockVisionBackend();
+            }
+            else
+            {
+                InitializeVisionClient();
+            }
+        }
+        
         bool connectionSuccess = await TestVisionConnection();
         
         if (connectionSuccess)
@@ -42,11 +350,30 @@ public class BudgetHoloLensVision : MonoBehaviour, IDisposable
             throw new InvalidOperationException("Azure Vision API credentials not found in configuration.");
         }
 
-        visionClient = new ComputerVisionClient(
+        visionBackend = new AzureVisionBackend(new ComputerVisionClient(
             new ApiKeyServiceClientCredentials(apiKey))
         {
             Endpoint = endpoint
-        };
+        });
+    }
+    
+    // Replaces the live spatial mesh, e.g. with one built from a recorded room
+    // for offline runs. Passing null goes back to the spatial awareness system.
+    public void UseSpatialMesh(SpatialMeshIndex mesh)
+    {
+        spatialMesh = mesh;
+        spatialMeshInjected = mesh != null;
+    }
+    
+    // Replaces the analysis backend, e.g. with a MockVisionBackend for offline
+    // runs. Must be called before Start to skip the Azure client entirely.
+    public void UseBackend(IVisionBackend backend)
+    {
+        if (visionBackend != null && visionBackend != backend)
+        {
+            visionBackend.Dispose();
+        }
+        visionBackend = backend;
     }
 
     private async Task<bool> TestVisionConnection()
@@ -55,8 +382,8 @@ public class BudgetHoloLensVision : MonoBehaviour, IDisposable
         {
             try
             {
-                await visionClient.ListModelsAsync();
-                Debug.Log("Azure Computer Vision connection successful");
+                await visionBackend.ProbeAsync(default);
+                Debug.Log("Vision backend connection successful");
                 return true;
             }
             catch (Exception ex)
@@ -75,236 +402,7591 @@ public class BudgetHoloLensVision : MonoBehaviour, IDisposable
     
     private void InitializeCamera()
     {
-        Resolution cameraResolution = PhotoCapture.SupportedResolutions
-            .OrderByDescending((res) => res.width * res.height)
-            .First();
+        bool streaming = false;
+#if ENABLE_WINMD_SUPPORT
+        streaming = useVideoStream;
+#endif
+        var supported = streaming ? VideoCapture.SupportedResolutions : PhotoCapture.SupportedResolutions;
+        var format = streaming ? CapturePixelFormat.NV12 : CapturePixelFormat.BGRA32;
+        if (autoTuneCapture)
+        {
+            profileSelector = new CaptureProfileSelector(supported, format, uploadLongEdge, profileWindowFrames);
+            var profile = profileSelector.Current;
+            cameraResolution = new Resolution { width = profile.Width, height = profile.Height };
+        }
+        else
+        {
+            cameraResolution = supported
+                .OrderByDescending((res) => res.width * res.height)
+                .First();
+        }
 
+#if ENABLE_WINMD_SUPPORT
+        if (streaming)
+        {
+            worldOrigin = Marshal.GetObjectForIUnknown(
+                UnityEngine.XR.WSA.WorldManager.GetNativeISpatialCoordinateSystemPtr()) as SpatialCoordinateSystem;
+            StartFrameStream(new MediaFrameStream(cameraResolution, format, worldOrigin));
+            return;
+        }
+#endif
         PhotoCapture.CreateAsync(false, OnPhotoCaptureCreated);
     }
-
-    private void OnPhotoCaptureCreated(PhotoCapture captureObject)
+    
+    // Restarts the camera in the selector's current profile. Photos already
+    // requested from the old mode fail and are dropped like any failed capture.
+    private void ApplyCaptureProfile()
     {
-        photoCaptureObject = captureObject;
+        var profile = profileSelector.Current;
+        var resolution = new Resolution { width = profile.Width, height = profile.Height };
+        CaptureProfileChanges++;
+        Debug.Log($"Switching capture profile to {profile}");
         
-        var cameraParameters = new CameraParameters()
+#if ENABLE_WINMD_SUPPORT
+        if (frameStream is MediaFrameStream)
         {
-            hologramOpacity = 0.0f,
-            cameraResolutionWidth = cameraResolution.width,
-            cameraResolutionHeight = cameraResolution.height,
-            pixelFormat = CapturePixelFormat.BGRA32
-        };
-        
-        photoCaptureObject.StartPhotoModeAsync(cameraParameters, OnPhotoModeStarted);
+            StartFrameStream(new MediaFrameStream(resolution, profile.Format, worldOrigin));
+            return;
+        }
+#endif
+        var capture = photoCaptureObject;
+        if (capture != null)
+        {
+            capture.StopPhotoModeAsync(stopped =>
+            {
+                cameraResolution = resolution;
+                capture.StartPhotoModeAsync(CreateCameraParameters(), OnPhotoModeStarted);
+            });
+        }
     }
-
-    private void OnPhotoModeStarted(PhotoCapture.PhotoCaptureResult result)
+    
+    // Switches capture to a file written by RecordFrames, played at its
+    // recorded rate, e.g. for offline tests of video mode.
+    public void UseRecordedStream(string path, bool loop = true)
     {
-        if (result.success)
+        StartFrameStream(new RecordedFrameStream(path, loop));
+    }
+    
+    // Writes BGRA32 frames (and optionally their poses) in the format
+    // UseRecordedStream plays.
+    public static void RecordFrames(string path, Resolution resolution, float framesPerSecond,
+        IReadOnlyList<byte[]> frames, IReadOnlyList<CameraPose> poses = null)
+    {
+        RecordedFrameStream.Write(path, resolution, framesPerSecond, frames, poses);
+    }
+    
+    private async void StartFrameStream(IFrameStream stream)
+    {
+        StopFrameStream();
+        frameRing = new FrameRing(streamRingFrames);
+        frameStream = stream;
+        cameraResolution = stream.Resolution;
+        captureFrame = TakeStreamFrame;
+        
+        try
         {
-            Debug.Log("Camera initialized successfully");
+            await stream.StartAsync(frameRing, lifetime.Token);
+            // The device may have settled on a different format.
+            cameraResolution = stream.Resolution;
+            Debug.Log("Camera stream started");
         }
-        else
+        catch (Exception ex) when (!(ex is OperationCanceledException))
         {
-            Debug.LogError("Failed to start photo mode");
-            CleanupCamera();
+            Debug.LogError($"Failed to start camera stream, using photo mode: {ex.Message}");
+            StopFrameStream();
+            PhotoCapture.CreateAsync(false, OnPhotoCaptureCreated);
         }
     }
     
-    public async Task AnalyzeWithCaching()
+    private void StopFrameStream()
     {
-        if (isDisposed)
+        frameStream?.Dispose();
+        frameStream = null;
+        frameRing?.Close();
+        frameRing = null;
+        captureFrame = CaptureImage;
+    }
+    
+    // NV12 frames are converted here, on a worker, so frames the pipeline
+    // skips are never converted at all. A capture waiting when the stream is
+    // replaced or stopped moves on to whichever capture path is current.
+    private async Task<(FrameBuffer Frame, CameraPose Pose, Resolution Resolution)> TakeStreamFrame()
+    {
+        var stream = frameStream;
+        var ring = frameRing;
+        if (ring == null)
         {
-            throw new ObjectDisposedException(nameof(BudgetHoloLensVision));
+            return await captureFrame();
         }
-
-        if (monthlyTransactionCount >= FREE_TIER_LIMIT)
+        
+        var (frame, pose, capturedAt) = await ring.TakeAsync(lifetime.Token);
+        if (frame == null)
         {
-            Debug.LogWarning("Monthly free tier limit reached");
-            return;
+            lifetime.Token.ThrowIfCancellationRequested();
+            return await captureFrame();
         }
         
-        if (isProcessing) return;
-        isProcessing = true;
-        
+        var resolution = stream?.Resolution ?? cameraResolution;
+        if (stream != null && stream.Format == CapturePixelFormat.NV12)
+        {
+            var nv12 = frame;
+            int width = resolution.width;
+            int height = resolution.height;
+            frame = await RunOnWorker(() =>
+            {
+                try
+                {
+                    var bgra = FrameBuffer.Rent(width * height * 4);
+                    ConvertNv12ToBgra32(nv12.Span, width, height, new Span<byte>(bgra.Array, 0, bgra.Length));
+                    return bgra;
+                }
+                finally
+                {
+                    nv12.Release();
+                }
+            });
+        }
+        captureLatency.Record(Stopwatch.GetTimestamp() - capturedAt);
+        return (frame, pose, resolution);
+    }
+    
+    // Pulls frames through the current capture path alone, with nothing
+    // downstream, and reports capture-to-available latency and the rate
+    // capture can sustain. Compare a device run in photo mode with one in
+    // video mode, or a recorded stream offline.
+    public async Task<CaptureReport> MeasureCapture(int frames = 100)
+    {
+        var previousLatency = captureLatency;
+        captureLatency = new LatencyRecorder(frames);
+        long skippedBefore = SkippedStreamFrames;
+        var total = Stopwatch.StartNew();
         try
         {
-            // Try local processing first
-            if (await TryLocalProcessing())
+            for (int i = 0; i < frames; i++)
             {
-                return;
+                var (frame, _, _) = await captureFrame();
+                frame.Release();
             }
-
-            byte[] imageBytes = await CaptureImage();
-            string imageHash = CalculateImageHash(imageBytes);
-            
-            // Check and clean cache
-            CleanExpiredCache();
             
-            if (resultCache.TryGetValue(imageHash, out DetectionResult cachedResult))
+            return new CaptureReport
             {
-                DisplayResults(cachedResult);
-                return;
+                Frames = frames,
+                VideoMode = IsVideoStreaming,
+                P50Milliseconds = captureLatency.PercentileMilliseconds(50),
+                P99Milliseconds = captureLatency.PercentileMilliseconds(99),
+                FramesPerSecond = total.Elapsed.TotalSeconds > 0 ? frames / total.Elapsed.TotalSeconds : 0,
+                SkippedFrames = SkippedStreamFrames - skippedBefore
+            };
+        }
+        finally
+        {
+            captureLatency = previousLatency;
+        }
+    }
+
+    // Replays recorded BGRA32 frames as each capture profile would have
+    // delivered them: downscaled to the profile's resolution, and through an
+    // NV12 round trip for NV12 profiles, then encoded and analyzed through
+    // the configured backend and budget. Use it with a recording made at the
+    // largest resolution to pick targetLatencyMilliseconds and
+    // targetConfidence for a backend; profiles larger than the recording are
+    // skipped.
+    public async Task<IReadOnlyList<CaptureProfileReport>> SweepCaptureProfiles(
+        IReadOnlyList<byte[]> frames, Resolution recordedResolution, IReadOnlyList<CaptureProfile> profiles)
+    {
+        var reports = new List<CaptureProfileReport>();
+        int sourceWidth = recordedResolution.width;
+        int sourceHeight = recordedResolution.height;
+        var encoding = uploadEncoding == UploadEncoding.Raw ? UploadEncoding.Jpeg : uploadEncoding;
+        int quality = uploadJpegQuality;
+        
+        foreach (var profile in profiles)
+        {
+            if (profile.Width > sourceWidth || profile.Height > sourceHeight)
+            {
+                continue;
             }
             
-            // Process with Azure if not in cache
-            using (var imageStream = new MemoryStream(imageBytes))
+            var latency = new LatencyRecorder(frames.Count);
+            long prepareTicks = 0;
+            long encodeTicks = 0;
+            long uploadBytes = 0;
+            double confidenceSum = 0;
+            int analyzed = 0;
+            int detections = 0;
+            var (targetWidth, targetHeight) = GetUploadSize(profile.Width, profile.Height);
+            
+            foreach (var pixels in frames)
             {
-                var features = new List<VisualFeatureTypes?>()
+                long start = Stopwatch.GetTimestamp();
+                var frame = FrameBuffer.Rent(profile.Width * profile.Height * 4);
+                DownscaleBgra32(pixels, sourceWidth, sourceHeight, frame.Array, profile.Width, profile.Height);
+                if (profile.Format == CapturePixelFormat.NV12)
                 {
-                    VisualFeatureTypes.Objects,
-                    VisualFeatureTypes.Tags
-                };
-                
-                var results = await ProcessWithRetry(async () =>
-                    await visionClient.AnalyzeImageInStreamAsync(
-                        imageStream, 
-                        features,
-                        cancellationToken: default)
-                );
+                    var nv12 = new byte[profile.Width * profile.Height * 3 / 2];
+                    ConvertBgra32ToNv12(frame.Span, profile.Width, profile.Height, nv12);
+                    ConvertNv12ToBgra32(nv12, profile.Width, profile.Height, new Span<byte>(frame.Array, 0, frame.Length));
+                }
+                long prepared = Stopwatch.GetTimestamp();
                 
-                var detectionResult = new DetectionResult(results);
-                resultCache[imageHash] = detectionResult;
+                FrameBuffer upload;
+                try
+                {
+                    upload = EncodeForUpload(frame, profile.Width, profile.Height, targetWidth, targetHeight, encoding, quality);
+                }
+                finally
+                {
+                    frame.Release();
+                }
+                long encoded = Stopwatch.GetTimestamp();
+                prepareTicks += prepared - start;
+                encodeTicks += encoded - prepared;
+                uploadBytes += upload.Length;
                 
-                DisplayResults(detectionResult);
-                monthlyTransactionCount++;
+                try
+                {
+                    var analysis = await AnalyzeUpload(upload, 1f, false, lifetime.Token);
+                    if (analysis != null)
+                    {
+                        var result = new DetectionResult(analysis.Objects);
+                        latency.Record(Stopwatch.GetTimestamp() - start);
+                        detections += result.Count;
+                        if (result.Count > 0)
+                        {
+                            confidenceSum += result.MeanConfidence;
+                            analyzed++;
+                        }
+                    }
+                }
+                finally
+                {
+                    upload.Release();
+                }
             }
+            
+            double msPerTick = 1000.0 / Stopwatch.Frequency;
+            reports.Add(new CaptureProfileReport
+            {
+                Profile = profile,
+                Frames = frames.Count,
+                PrepareMilliseconds = frames.Count > 0 ? prepareTicks * msPerTick / frames.Count : 0,
+                EncodeMilliseconds = frames.Count > 0 ? encodeTicks * msPerTick / frames.Count : 0,
+                P50Milliseconds = latency.PercentileMilliseconds(50),
+                P99Milliseconds = latency.PercentileMilliseconds(99),
+                UploadBytesPerFrame = frames.Count > 0 ? uploadBytes / frames.Count : 0,
+                MeanConfidence = analyzed > 0 ? confidenceSum / analyzed : 0,
+                DetectionsPerFrame = frames.Count > 0 ? (double)detections / frames.Count : 0
+            });
         }
-        catch (Exception ex)
-        {
-            Debug.LogError($"Error in vision processing: {ex.Message}");
-        }
-        finally
-        {
-            isProcessing = false;
-        }
+        return reports;
     }
 
-    private async Task<T> ProcessWithRetry<T>(Func<Task<T>> operation)
+    // Uploads every BGRA32 frame once as a full-resolution PNG for
+    // reference, then downscaled to each long edge in longEdges (0 keeps the
+    // full size) and JPEG-encoded at each quality. Reports bytes per upload,
+    // downscale-and-encode time, and how well the detections agree with the
+    // reference. Every upload is a backend call, frames x (1 + sizes x
+    // qualities) in all, so keep the recording short against a billed
+    // service.
+    public static async Task<IReadOnlyList<UploadEncodingReport>> SweepUploadEncoding(
+        IVisionBackend backend, IReadOnlyList<byte[]> frames, Resolution resolution,
+        IReadOnlyList<int> longEdges, IReadOnlyList<int> qualities, CancellationToken cancellationToken = default)
     {
-        for (int attempt = 0; attempt < MAX_RETRY_ATTEMPTS; attempt++)
+        int width = resolution.width;
+        int height = resolution.height;
+        
+        async Task<DetectionResult> Analyze(FrameBuffer upload, float coordinateScale)
+        {
+            using (var stream = upload.OpenReadStream())
+            {
+                var analysis = await backend.AnalyzeAsync(stream, objectFeatures, cancellationToken);
+                return new DetectionResult(analysis.Objects, null, coordinateScale);
+            }
+        }
+        
+        var references = new DetectionResult[frames.Count];
+        for (int i = 0; i < frames.Count; i++)
         {
+            var upload = EncodeForUpload(FrameBuffer.Wrap(frames[i]), width, height, width, height, UploadEncoding.Png, 0);
             try
             {
-                return await operation();
+                references[i] = await Analyze(upload, 1f);
             }
-            catch (Exception ex) when (IsTransientException(ex))
+            finally
             {
-                if (attempt == MAX_RETRY_ATTEMPTS - 1)
-                    throw;
-                
-                await Task.Delay(TimeSpan.FromSeconds(Math.Pow(2, attempt)));
+                upload.Release();
             }
         }
         
-        throw new Exception("Retry attempts exhausted");
-    }
-
-    private bool IsTransientException(Exception ex)
-    {
-        // Add logic to identify transient exceptions
-        return ex is TimeoutException || ex is IOException;
+        var reports = new List<UploadEncodingReport>();
+        foreach (int longEdge in longEdges)
+        {
+            int sourceEdge = Math.Max(width, height);
+            float scale = longEdge > 0 && sourceEdge > longEdge ? (float)longEdge / sourceEdge : 1f;
+            int targetWidth = Math.Max(1, (int)Math.Round(width * scale));
+            int targetHeight = Math.Max(1, (int)Math.Round(height * scale));
+            foreach (int quality in qualities)
+            {
+                long encodeTicks = 0;
+                long bytes = 0;
+                double agreement = 0;
+                for (int i = 0; i < frames.Count; i++)
+                {
+                    long start = Stopwatch.GetTimestamp();
+                    var upload = EncodeForUpload(FrameBuffer.Wrap(frames[i]), width, height, targetWidth, targetHeight, UploadEncoding.Jpeg, quality);
+                    encodeTicks += Stopwatch.GetTimestamp() - start;
+                    bytes += upload.Length;
+                    try
+                    {
+                        agreement += DetectionAgreement(references[i], await Analyze(upload, (float)targetWidth / width));
+                    }
+                    finally
+                    {
+                        upload.Release();
+                    }
+                }
+                
+                reports.Add(new UploadEncodingReport
+                {
+                    Width = targetWidth,
+                    Height = targetHeight,
+                    Quality = quality,
+                    Frames = frames.Count,
+                    BytesPerUpload = frames.Count > 0 ? bytes / frames.Count : 0,
+                    EncodeMilliseconds = frames.Count > 0 ? encodeTicks * 1000.0 / Stopwatch.Frequency / frames.Count : 0,
+                    Agreement = frames.Count > 0 ? agreement / frames.Count : 0
+                });
+            }
+        }
+        return reports;
     }
     
-    private void CleanExpiredCache()
+    // F1 score of candidate against reference: a detection matches one of
+    // the same label whose box overlaps it with IoU of at least 0.5, each
+    // reference detection matching at most once. Two empty results agree.
+    private static double DetectionAgreement(DetectionResult reference, DetectionResult candidate)
     {
-        var expiredKeys = resultCache
-            .Where(kvp => (DateTime.Now - kvp.Value.Timestamp).TotalHours > CACHE_EXPIRATION_HOURS)
-            .Select(kvp => kvp.Key)
-            .ToList();
+        if (reference.Count == 0 && candidate.Count == 0)
+        {
+            return 1;
+        }
         
-        foreach (var key in expiredKeys)
+        var referenceLabels = reference.LabelIds;
+        var referenceBoxes = reference.Rectangles;
+        var candidateLabels = candidate.LabelIds;
+        var candidateBoxes = candidate.Rectangles;
+        var used = new bool[reference.Count];
+        int matched = 0;
+        for (int c = 0; c < candidate.Count; c++)
         {
-            resultCache.Remove(key);
+            for (int r = 0; r < reference.Count; r++)
+            {
+                if (used[r] || referenceLabels[r] != candidateLabels[c])
+                {
+                    continue;
+                }
+                
+                float left = Math.Max(referenceBoxes[r * 4], candidateBoxes[c * 4]);
+                float top = Math.Max(referenceBoxes[r * 4 + 1], candidateBoxes[c * 4 + 1]);
+                float right = Math.Min(referenceBoxes[r * 4] + referenceBoxes[r * 4 + 2], candidateBoxes[c * 4] + candidateBoxes[c * 4 + 2]);
+                float bottom = Math.Min(referenceBoxes[r * 4 + 1] + referenceBoxes[r * 4 + 3], candidateBoxes[c * 4 + 1] + candidateBoxes[c * 4 + 3]);
+                float intersection = Math.Max(0, right - left) * Math.Max(0, bottom - top);
+                float union = referenceBoxes[r * 4 + 2] * referenceBoxes[r * 4 + 3] +
+                    candidateBoxes[c * 4 + 2] * candidateBoxes[c * 4 + 3] - intersection;
+                if (union > 0 && intersection >= 0.5f * union)
+                {
+                    used[r] = true;
+                    matched++;
+                    break;
+                }
+            }
         }
+        return 2.0 * matched / (reference.Count + candidate.Count);
     }
-    
-    private void DisplayResults(DetectionResult result)
+
+    private void OnPhotoCaptureCreated(PhotoCapture captureObject)
     {
-        foreach (var detection in result.Detections)
-        {
-            CreateHolographicLabel(
-                detection.ObjectName,
-                detection.Confidence,
-                detection.Location
-            );
-        }
+        photoCaptureObject = captureObject;
+        photoCaptureObject.StartPhotoModeAsync(CreateCameraParameters(), OnPhotoModeStarted);
     }
     
-    private async Task<bool> TryLocalProcessing()
+    private CameraParameters CreateCameraParameters()
     {
-        // Implement basic local image processing here
-        // Return true if successful, false if needs cloud processing
-        return false;
+        return new CameraParameters()
+        {
+            hologramOpacity = 0.0f,
+            cameraResolutionWidth = cameraResolution.width,
+            cameraResolutionHeight = cameraResolution.height,
+            pixelFormat = CapturePixelFormat.BGRA32
+        };
     }
 
-    private string CalculateImageHash(byte[] imageBytes)
+    private void OnPhotoModeStarted(PhotoCapture.PhotoCaptureResult result)
     {
-        using (var sha256 = System.Security.Cryptography.SHA256.Create())
+        if (result.success)
+        {
+            Debug.Log("Camera initialized successfully");
+        }
+        else
         {
-            return Convert.ToBase64String(sha256.ComputeHash(imageBytes));
+            Debug.LogError("Failed to start photo mode");
+            CleanupCamera();
         }
     }
-
-    private void CreateHolographicLabel(string objectName, double confidence, Vector3 location)
+    
+    // Queues a frame into the capture -> hash -> cache lookup -> analyze ->
+    // label pipeline and completes once that frame is displayed or dropped.
+    // Capture of the next frame overlaps remote analysis of the previous one;
+    // full queues drop their oldest frame so the freshest frame wins.
+    public async Task AnalyzeWithCaching()
     {
-        // Implement holographic label creation
-        // This would depend on your specific MRTK implementation
+        await SubmitFrame();
     }
-
-    private class DetectionResult
+    
+    // Returns true when the frame made it to the display, false if it was
+    // dropped, rejected or failed.
+    private async Task<bool> SubmitFrame()
     {
-        public List<(string ObjectName, double Confidence, Vector3 Location)> Detections { get; }
-        public DateTime Timestamp { get; }
+        if (isDisposed)
+        {
+            throw new ObjectDisposedException(nameof(BudgetHoloLensVision));
+        }
+
+        if (budget.IsExhausted)
+        {
+            Debug.LogWarning("Monthly free tier limit reached");
+            return false;
+        }
+        
+        var job = new FrameJob(nextFrameSequence++);
+        LinkedListNode<FrameJob> node;
+        lock (activeJobs)
+        {
+            node = activeJobs.AddLast(job);
+        }
         
-        public DetectionResult(ImageAnalysis analysis)
+        try
         {
-            Detections = new List<(string, double, Vector3)>();
-            Timestamp = DateTime.Now;
+            long submittedAt = Stopwatch.GetTimestamp();
+            captureStage.Post(job);
+            bool displayed = await job.Completion;
             
-            foreach (var obj in analysis.Objects)
+            // Tracked frames never touch capture-size-dependent work beyond
+            // the tracker, so only analyzed frames steer the profile.
+            if (displayed && !job.IsTracked && profileSelector != null &&
+                profileSelector.RecordLatency(Stopwatch.GetTimestamp() - submittedAt, targetLatencyMilliseconds, targetConfidence))
             {
-                Detections.Add((
-                    obj.ObjectProperty,
-                    obj.Confidence,
-                    new Vector3(obj.Rectangle.X, obj.Rectangle.Y, 0)
-                ));
+                ApplyCaptureProfile();
+            }
+            return displayed;
+        }
+        finally
+        {
+            lock (activeJobs)
+            {
+                activeJobs.Remove(node);
             }
         }
     }
-
-    public void Dispose()
-    {
-        if (isDisposed)
-            return;
-
-        isDisposed = true;
-        CleanupCamera();
-        visionClient?.Dispose();
-    }
-
-    private void CleanupCamera()
+    
+    private void InitializePipeline()
     {
-        if (photoCaptureObject != null)
+        captureStage = new PipelineStage("capture", captureLimits, CaptureStage);
+        sceneStage = new PipelineStage("scene", sceneLimits, SceneStage);
+        trackStage = new PipelineStage("track", trackLimits, TrackStage);
+        hashStage = new PipelineStage("hash", hashLimits, HashStage);
+        lookupStage = new PipelineStage("lookup", lookupLimits, LookupStage);
+        localStage = new PipelineStage("local", localLimits, LocalStage);
+        encodeStage = new PipelineStage("encode", encodeLimits, EncodeStage);
+        // Frames waiting for a mosaic count as in flight, so a batch needs room for all of them.
+        var limits = analyzeLimits;
+        if (useMosaicBatching)
         {
-            photoCaptureObject.StopPhotoModeAsync(OnPhotoModeStopped);
+            limits.maxInFlight = Math.Max(limits.maxInFlight, mosaicMaxFrames);
+            mosaicBatcher = new MosaicBatcher(
+                mosaicMaxFrames,
+                TimeSpan.FromMilliseconds(mosaicWindowMilliseconds),
+                uploadLongEdge,
+                (upload, novelty) => AnalyzeUpload(upload, novelty, false, lifetime.Token),
+                () => (uploadEncoding, uploadJpegQuality));
         }
+        analyzeStage = new PipelineStage("analyze", limits, AnalyzeStage);
+        projectStage = new PipelineStage("project", projectLimits, ProjectStage);
+        labelStage = new PipelineStage("label", labelLimits, LabelStage);
     }
-
-    private void OnPhotoModeStopped(PhotoCapture.PhotoCaptureResult result)
+    
+    public IReadOnlyList<PipelineStageStats> GetPipelineStats()
     {
-        photoCaptureObject.Dispose();
-        photoCaptureObject = null;
+        return new[]
+        {
+            captureStage.GetStats(),
+            sceneStage.GetStats(),
+            trackStage.GetStats(),
+            hashStage.GetStats(),
+            lookupStage.GetStats(),
+            localStage.GetStats(),
+            encodeStage.GetStats(),
+            analyzeStage.GetStats(),
+            projectStage.GetStats(),
+            labelStage.GetStats()
+        };
     }
-
-    private void OnDestroy()
+    
+    private async Task<PipelineStage> CaptureStage(FrameJob job)
     {
-        Dispose();
+        (job.Frame, job.Pose, job.Resolution) = await captureFrame();
+        if (overlapHashing)
+        {
+            job.HashTask = StartHash(job);
+        }
+        return sceneStage;
     }
-
-    private async Task<byte[]> CaptureImage()
+    
+    // Computes the frame's cache key on a worker: tile keys, a perceptual
+    // hash, or an exact key, whichever the lookup stage will use. Started
+    // from the capture stage with overlapHashing, so it runs while the frame
+    // is still in the scene and track stages. Holds its own reference so the
+    // frame outlives an abandoned job.
+    private Task StartHash(FrameJob job)
     {
-        // Implementation would depend on your specific requirements
-        // This is a placeholder that should be implemented based on your needs
-        throw new NotImplementedException("CaptureImage needs to be implemented");
+        var frame = job.Frame.AddRef();
+        var resolution = job.Resolution;
+        bool perceptual = usePerceptualCacheKeys;
+        bool tiled = useTiledAnalysis;
+        int columns = Math.Max(1, Math.Min(tileColumns, 8));
+        int rows = Math.Max(1, Math.Min(tileRows, 8));
+        var algorithm = exactKeyHash;
+        return RunOnWorker(() =>
+        {
+            try
+            {
+                if (job.HashAbandoned || job.Token.IsCancellationRequested)
+                {
+                    return;
+                }
+                
+                // Frames too small to tile fall back to a whole-frame key.
+                if (tiled && TryCalculateTileKeys(frame.Span, resolution.width, resolution.height,
+                    columns, rows, out job.TileKeys))
+                {
+                    job.TileColumns = columns;
+                    job.TileRows = rows;
+                    return;
+                }
+                
+                job.IsPerceptual = perceptual && TryCalculatePerceptualHash(
+                    frame.Span, resolution.width, resolution.height, out job.PerceptualHash);
+                if (!job.IsPerceptual)
+                {
+                    job.CacheKey = FrameHasher.Hash(frame.Span, algorithm,
+                        () => job.HashAbandoned || job.Token.IsCancellationRequested);
+                    ProbeResultCache(job, job.CacheKey);
+                }
+            }
+            finally
+            {
+                frame.Release();
+            }
+        });
+    }
+    
+    // The in-memory cache is safe from any thread, so the worker that made
+    // an exact key looks it up at once; the lookup stage then only has to
+    // fall back to the persistent store on a miss.
+    private void ProbeResultCache(FrameJob job, CacheKey key)
+    {
+        if (!key.IsEmpty && resultCache.TryGetValue(key, out DetectionResult result))
+        {
+            job.CachedResult = result;
+        }
+    }
+    
+    // Cheap change detector in front of hashing: when the view has not
+    // changed since the last displayed frame, its result is shown again and
+    // the frame never reaches the hash, cache or network.
+    private Task<PipelineStage> SceneStage(FrameJob job)
+    {
+        if (!useSceneChangeGate)
+        {
+            return Task.FromResult(trackStage);
+        }
+        
+        long start = Stopwatch.GetTimestamp();
+        var thumbnail = new byte[SCENE_GRID_WIDTH * SCENE_GRID_HEIGHT];
+        bool sampled = TrySampleLumaGrid(job.Frame.Span, job.Resolution.width, job.Resolution.height,
+            SCENE_GRID_WIDTH, SCENE_GRID_HEIGHT, 4, thumbnail);
+        
+        bool unchanged = false;
+        if (sampled && lastSceneThumbnail != null && lastSceneResult != null)
+        {
+            int difference = 0;
+            for (int i = 0; i < thumbnail.Length; i++)
+            {
+                difference += Math.Abs(thumbnail[i] - lastSceneThumbnail[i]);
+            }
+            unchanged = difference < sceneChangeThreshold * thumbnail.Length;
+            
+            // Novelty rises from 0 at the gate threshold to 1 at four times it.
+            float meanDifference = (float)difference / thumbnail.Length;
+            float threshold = Math.Max(sceneChangeThreshold, 1f);
+            job.Novelty = Math.Max(0f, Math.Min(1f, (meanDifference - threshold) / (3f * threshold)));
+        }
+        
+        sceneDetectorTicks += Stopwatch.GetTimestamp() - start;
+        SceneGatedFrames++;
+        
+        // Skipped frames keep the old reference so slow drift still accumulates.
+        job.SceneThumbnail = sampled && !unchanged ? thumbnail : null;
+        
+        if (unchanged)
+        {
+            SceneSkippedFrames++;
+            job.Result = lastSceneResult;
+            job.HashAbandoned = true;
+            return Task.FromResult(projectStage);
+        }
+        return Task.FromResult(trackStage);
+    }
+    
+    // Between analyses, moves the last analyzed boxes along with the scene.
+    // Frames the tracker cannot vouch for go on to hashing; their luma is
+    // kept so the result they end up with can seed the tracker.
+    private async Task<PipelineStage> TrackStage(FrameJob job)
+    {
+        if (!useTracking)
+        {
+            return hashStage;
+        }
+        
+        var frame = job.Frame;
+        var resolution = job.Resolution;
+        int maxFrames = trackerMaxFrames;
+        float minConfidence = trackerMinConfidence;
+        long elapsed = 0;
+        var tracked = await RunOnWorker(() =>
+        {
+            long start = Stopwatch.GetTimestamp();
+            var luma = ObjectTracker.SampleLuma(frame.Span, resolution.width, resolution.height);
+            job.TrackLuma = luma;
+            var result = luma != null ? tracker.Track(luma, resolution.width, resolution.height, maxFrames, minConfidence) : null;
+            elapsed = Stopwatch.GetTimestamp() - start;
+            return result;
+        }, job.Token);
+        
+        trackerTicks += elapsed;
+        TrackerFrames++;
+        if (tracked == null)
+        {
+            return hashStage;
+        }
+        
+        TrackedFrames++;
+        job.Result = tracked;
+        job.IsTracked = true;
+        job.HashAbandoned = true;
+        return projectStage;
+    }
+    
+    // Without overlapHashing the key is only started here.
+    private async Task<PipelineStage> HashStage(FrameJob job)
+    {
+        long start = Stopwatch.GetTimestamp();
+        await (job.HashTask ?? StartHash(job));
+        
+        // An unfinished key only comes from a frame cancelled mid-hash.
+        job.Token.ThrowIfCancellationRequested();
+        hashWaitTicks += Stopwatch.GetTimestamp() - start;
+        HashedFrames++;
+        return lookupStage;
+    }
+    
+    // The persistent store and perceptual index are only touched from stage
+    // continuations, which Unity's synchronization context runs on the main
+    // thread; the result cache may also be probed from hash workers.
+    private async Task<PipelineStage> LookupStage(FrameJob job)
+    {
+        // Check and clean cache
+        CleanExpiredCache();
+        await EnsurePersistentCacheLoaded();
+        
+        if (job.TileKeys != null)
+        {
+            job.TileResults = new DetectionResult[job.TileKeys.Length];
+            int hits = 0;
+            for (int i = 0; i < job.TileKeys.Length; i++)
+            {
+                if (TryGetCachedResult(job.TileKeys[i], out job.TileResults[i]))
+                {
+                    hits++;
+                }
+            }
+            TileCacheHits += hits;
+            
+            if (hits == job.TileKeys.Length)
+            {
+                CacheHits++;
+                job.Result = DetectionResult.Concat(job.TileResults);
+                job.IsFresh = true;
+                return projectStage;
+            }
+            
+            // The local detector and mosaic batcher work on whole frames.
+            return encodeStage;
+        }
+        
+        if (job.IsPerceptual)
+        {
+            if (perceptualIndex.TryFindNearest(job.PerceptualHash, perceptualHashMaxDistance, out ulong match, out int distance) &&
+                TryGetCachedResult(CacheKey.FromPerceptualHash(match), out DetectionResult nearResult))
+            {
+                CacheHits++;
+                if (distance > 0) NearDuplicateCacheHits++;
+                job.Result = nearResult;
+                job.IsFresh = true;
+                return projectStage;
+            }
+            
+            job.CacheKey = CacheKey.FromPerceptualHash(job.PerceptualHash);
+        }
+        else if (job.CachedResult != null || TryGetCachedResult(job.CacheKey, out job.CachedResult))
+        {
+            CacheHits++;
+            job.Result = job.CachedResult;
+            job.IsFresh = true;
+            return projectStage;
+        }
+        
+        return localStage;
+    }
+    
+    // Cache misses get a chance on the on-device detector before paying for
+    // a remote call.
+    private async Task<PipelineStage> LocalStage(FrameJob job)
+    {
+        DetectionResult localResult = await TryLocalProcessing(job.Frame, job.Resolution, job.Token);
+        if (localResult != null && localResult.MinimumConfidence >= localConfidenceThreshold)
+        {
+            LocallyResolvedFrames++;
+            job.Result = localResult;
+            job.IsFresh = true;
+            return projectStage;
+        }
+        
+        // Kept in case the backend is down when the frame reaches analysis.
+        job.LocalFallback = localResult;
+        
+        // The batcher builds its own encoded mosaic.
+        return mosaicBatcher != null ? analyzeStage : encodeStage;
+    }
+    
+    // Downscales and compresses a cache miss on a worker thread. The service
+    // only needs enough pixels to find objects, and Azure does not accept raw
+    // BGRA32 anyway.
+    private async Task<PipelineStage> EncodeStage(FrameJob job)
+    {
+        var encoding = uploadEncoding;
+        int width = job.Resolution.width;
+        int height = job.Resolution.height;
+        
+        if (job.TileKeys != null)
+        {
+            await EncodeChangedTiles(job, encoding);
+            return analyzeStage;
+        }
+        
+        if (encoding == UploadEncoding.Raw || job.Frame.Length != width * height * 4)
+        {
+            job.UploadFrame = job.Frame.AddRef();
+            job.UploadScale = 1f;
+            return analyzeStage;
+        }
+        
+        var (targetWidth, targetHeight) = GetUploadSize(width, height);
+        int quality = uploadJpegQuality;
+        
+        job.UploadFrame = await RunOnWorker(
+            () => EncodeForUpload(job.Frame, width, height, targetWidth, targetHeight, encoding, quality),
+            job.Token);
+        job.UploadScale = (float)targetWidth / width;
+        return analyzeStage;
+    }
+    
+    private (int Width, int Height) GetUploadSize(int width, int height)
+    {
+        int longEdge = Math.Max(width, height);
+        float scale = uploadLongEdge > 0 && longEdge > uploadLongEdge ? (float)uploadLongEdge / longEdge : 1f;
+        return (Math.Max(1, (int)Math.Round(width * scale)), Math.Max(1, (int)Math.Round(height * scale)));
+    }
+    
+    private static FrameBuffer EncodeForUpload(
+        FrameBuffer frame, int width, int height, int targetWidth, int targetHeight, UploadEncoding encoding, int quality)
+    {
+        FrameBuffer scaled = frame.AddRef();
+        if (targetWidth != width || targetHeight != height)
+        {
+            scaled.Release();
+            scaled = FrameBuffer.Rent(targetWidth * targetHeight * 4);
+            DownscaleBgra32(frame.Span, width, height, scaled.Array, targetWidth, targetHeight);
+        }
+        
+        try
+        {
+            return FrameBuffer.Wrap(EncodeBgra32(scaled.Array, targetWidth, targetHeight, encoding, quality));
+        }
+        finally
+        {
+            scaled.Release();
+        }
+    }
+    
+    // Packs the tiles that missed the cache into one mosaic, each downscaled
+    // by the factor the whole frame would get, so per-tile detail matches an
+    // ordinary upload.
+    private async Task EncodeChangedTiles(FrameJob job, UploadEncoding encoding)
+    {
+        int width = job.Resolution.width;
+        int height = job.Resolution.height;
+        int longEdge = Math.Max(width, height);
+        float scale = uploadLongEdge > 0 && longEdge > uploadLongEdge ? (float)uploadLongEdge / longEdge : 1f;
+        int quality = uploadJpegQuality;
+        
+        var changed = new List<int>();
+        for (int i = 0; i < job.TileResults.Length; i++)
+        {
+            if (job.TileResults[i] == null) changed.Add(i);
+        }
+        
+        int tileWidth = (width + job.TileColumns - 1) / job.TileColumns;
+        int tileHeight = (height + job.TileRows - 1) / job.TileRows;
+        int packedWidth = Math.Max(1, (int)Math.Round(tileWidth * scale));
+        int packedHeight = Math.Max(1, (int)Math.Round(tileHeight * scale));
+        var tiles = LayoutMosaic(changed.Count, packedWidth, packedHeight, out int mosaicWidth, out int mosaicHeight);
+        for (int i = 0; i < changed.Count; i++)
+        {
+            int column = changed[i] % job.TileColumns;
+            int row = changed[i] / job.TileColumns;
+            tiles[i].SourceX = column * width / job.TileColumns;
+            tiles[i].SourceY = row * height / job.TileRows;
+            tiles[i].SourceWidth = (column + 1) * width / job.TileColumns - tiles[i].SourceX;
+            tiles[i].SourceHeight = (row + 1) * height / job.TileRows - tiles[i].SourceY;
+        }
+        
+        job.UploadFrame = await RunOnWorker(() =>
+        {
+            var mosaic = FrameBuffer.Rent(mosaicWidth * mosaicHeight * 4);
+            Array.Clear(mosaic.Array, 0, mosaic.Length);
+            foreach (var tile in tiles)
+            {
+                DownscaleBgra32Region(job.Frame.Span, width, tile.SourceX, tile.SourceY, tile.SourceWidth, tile.SourceHeight,
+                    mosaic.Array, tile.PackedWidth, tile.PackedHeight, mosaicWidth, tile.PackedY * mosaicWidth + tile.PackedX);
+            }
+            
+            if (encoding == UploadEncoding.Raw)
+            {
+                return mosaic;
+            }
+            
+            try
+            {
+                return FrameBuffer.Wrap(EncodeBgra32(mosaic.Array, mosaicWidth, mosaicHeight, encoding, quality));
+            }
+            finally
+            {
+                mosaic.Release();
+            }
+        }, job.Token);
+        job.UploadTiles = tiles;
+        job.ChangedTiles = changed;
+        UploadedTiles += changed.Count;
+    }
+    
+    // Splits one tiled analysis back into per-tile cache entries and merges
+    // them with the tiles that hit.
+    private async Task<bool> AnalyzeChangedTiles(FrameJob job)
+    {
+        var analysis = await AnalyzeUpload(job.UploadFrame, job.Novelty, false, job.Token);
+        if (analysis == null)
+        {
+            return false;
+        }
+        
+        var perTile = SplitMosaicObjects(analysis.Objects, job.UploadTiles);
+        for (int i = 0; i < perTile.Length; i++)
+        {
+            int index = job.ChangedTiles[i];
+            var tileResult = new DetectionResult(perTile[i]);
+            job.TileResults[index] = tileResult;
+            resultCache.Set(job.TileKeys[index], tileResult);
+            persistentStore?.Append(job.TileKeys[index], tileResult);
+        }
+        job.Result = DetectionResult.Concat(job.TileResults);
+        job.IsFresh = true;
+        return true;
+    }
+    
+    // Frames the budget turns away finish without a result and are reported
+    // as dropped.
+    private async Task<PipelineStage> AnalyzeStage(FrameJob job)
+    {
+        if (budget.IsExhausted)
+        {
+            Debug.LogWarning("Monthly free tier limit reached");
+            return null;
+        }
+        
+        if (circuitBreaker.IsOpen)
+        {
+            return Fallback(job);
+        }
+        
+        ImageAnalysis analysis;
+        try
+        {
+            if (job.TileKeys != null)
+            {
+                if (!await AnalyzeChangedTiles(job))
+                {
+                    return null;
+                }
+                RemotelyAnalyzedFrames++;
+                return projectStage;
+            }
+            
+            analysis = mosaicBatcher != null
+                ? await mosaicBatcher.Analyze(job)
+                : await AnalyzeUpload(job.UploadFrame, job.Novelty, requestTags, job.Token);
+        }
+        catch (CircuitOpenException)
+        {
+            return Fallback(job);
+        }
+        
+        if (analysis == null)
+        {
+            return null;
+        }
+        
+        job.Result = new DetectionResult(analysis, mosaicBatcher != null ? 1f : job.UploadScale);
+        job.IsFresh = true;
+        RemotelyAnalyzedFrames++;
+        
+        resultCache.Set(job.CacheKey, job.Result);
+        persistentStore?.Append(job.CacheKey, job.Result);
+        if (job.IsPerceptual)
+        {
+            perceptualIndex.Add(job.PerceptualHash);
+        }
+        return projectStage;
+    }
+    
+    // One analysis of an encoded upload, whether a single frame or a mosaic.
+    // Every attempt is a billed transaction, so each retry reserves budget of
+    // its own; an attempt that may have reached the service (timed out,
+    // cancelled mid-flight, failed after sending) stays counted, and only a
+    // reservation that provably never left the device is refunded. Returns
+    // null when the budget scheduler declines the first attempt.
+    private async Task<ImageAnalysis> AnalyzeUpload(FrameBuffer upload, float novelty, bool includeTags, CancellationToken cancellationToken)
+    {
+        bool sent = false;
+        
+        // Reserve the transaction up front so concurrent analyses cannot overrun the limit.
+        if (!await AcquireBudget(novelty, cancellationToken))
+        {
+            return null;
+        }
+        
+        // True while a reservation is held that no attempt has spent yet.
+        bool reserved = true;
+        try
+        {
+            var features = includeTags ? objectAndTagFeatures : objectFeatures;
+            var results = await ProcessWithRetry(
+                attemptToken =>
+                {
+                    reserved = false;
+                    sent = true;
+                    return AnalyzeWithHedge(upload, features, attemptToken);
+                },
+                async (failure, retryToken) =>
+                {
+                    // An attempt that never left the device hands its reservation on.
+                    reserved |= NeverReachedService(failure);
+                    if (!reserved)
+                    {
+                        reserved = await AcquireBudget(novelty, retryToken);
+                    }
+                    return reserved;
+                },
+                cancellationToken);
+            
+            RemoteCalls++;
+            UploadedBytes += upload.Length;
+            return results;
+        }
+        catch (OperationCanceledException) when (cancellationToken.IsCancellationRequested)
+        {
+            if (reserved)
+            {
+                budget.Refund();
+            }
+            if (!sent)
+            {
+                BandwidthSavedBytes += upload.Length;
+            }
+            throw;
+        }
+        catch (Exception ex)
+        {
+            if (reserved || NeverReachedService(ex))
+            {
+                budget.Refund();
+            }
+            throw;
+        }
+    }
+    
+    // Failures that happened before the request left the device: an open
+    // circuit, or a connection that was never established. Anything else,
+    // timeouts included, may have been billed.
+    private static bool NeverReachedService(Exception ex)
+    {
+        return ex is CircuitOpenException ||
+            (ex is HttpRequestException && ex.InnerException is SocketException);
+    }
+    
+    // Sends the call and, if it has not answered by the p95 of recent calls,
+    // a duplicate. The first successful answer is returned and the other call
+    // cancelled; if one fails, the other is awaited. A call aborted through
+    // cancellationToken (superseded frame, teardown or attempt timeout) counts
+    // as a CancelledRequest; a losing hedge counts as a HedgeCancellation.
+    // Neither saves bandwidth, since the upload was already on its way.
+    private async Task<ImageAnalysis> AnalyzeWithHedge(
+        FrameBuffer upload, IList<VisualFeatureTypes?> features, CancellationToken cancellationToken)
+    {
+        try
+        {
+            return await AnalyzeWithHedgeCore(upload, features, cancellationToken);
+        }
+        catch (OperationCanceledException) when (cancellationToken.IsCancellationRequested)
+        {
+            CancelledRequests++;
+            throw;
+        }
+    }
+    
+    private async Task<ImageAnalysis> AnalyzeWithHedgeCore(
+        FrameBuffer upload, IList<VisualFeatureTypes?> features, CancellationToken cancellationToken)
+    {
+        if (!useHedgedRequests || callLatency.Count < HEDGE_MIN_SAMPLES)
+        {
+            return await TimedAnalyze(upload, features, cancellationToken);
+        }
+        
+        var hedgeDelay = TimeSpan.FromMilliseconds(callLatency.PercentileMilliseconds(95));
+        using (var primarySource = CancellationTokenSource.CreateLinkedTokenSource(cancellationToken))
+        using (var hedgeSource = CancellationTokenSource.CreateLinkedTokenSource(cancellationToken))
+        {
+            var primary = TimedAnalyze(upload, features, primarySource.Token);
+            if (await Task.WhenAny(primary, Task.Delay(hedgeDelay, cancellationToken)) == primary ||
+                cancellationToken.IsCancellationRequested ||
+                !budget.TryAcquireHedge((int)(FREE_TIER_LIMIT * hedgeBudgetFraction)))
+            {
+                return await primary;
+            }
+            
+            // Like the primary, the hedge is on disk before it is sent.
+            if (!await budget.WhenSaved() || primary.IsCompleted)
+            {
+                budget.Refund(hedge: true);
+                return await primary;
+            }
+            
+            HedgedCalls++;
+            var hedge = TimedAnalyze(upload, features, hedgeSource.Token);
+            var first = await Task.WhenAny(primary, hedge);
+            var other = first == primary ? hedge : primary;
+            if (first.Status != TaskStatus.RanToCompletion)
+            {
+                Observe(first);
+                return await other;
+            }
+            
+            if (!other.IsCompleted)
+            {
+                HedgeCancellations++;
+            }
+            (first == primary ? hedgeSource : primarySource).Cancel();
+            Observe(other);
+            if (first == hedge) HedgeWins++;
+            return first.Result;
+        }
+    }
+    
+    // One backend call over a fresh, non-copying stream of the pooled upload.
+    // Successful call times feed the hedging threshold.
+    private async Task<ImageAnalysis> TimedAnalyze(
+        FrameBuffer upload, IList<VisualFeatureTypes?> features, CancellationToken cancellationToken)
+    {
+        long start = Stopwatch.GetTimestamp();
+        using (var imageStream = upload.OpenReadStream())
+        {
+            try
+            {
+                var analysis = await visionBackend.AnalyzeAsync(
+                    imageStream, 
+                    features,
+                    cancellationToken);
+                callLatency.Record(Stopwatch.GetTimestamp() - start);
+                return analysis;
+            }
+            catch (VisionThrottledException ex)
+            {
+                // Hold back every caller, not just this retry loop.
+                budget.Pause(ex.RetryAfter ?? TimeSpan.FromSeconds(1));
+                throw;
+            }
+        }
+    }
+    
+    // Marks the abandoned call's failure as observed.
+    private static void Observe(Task task)
+    {
+        _ = task.ContinueWith(t => t.Exception, TaskContinuationOptions.OnlyOnFaulted);
+    }
+    
+    // While the backend is unhealthy, show whatever the local detector found
+    // regardless of confidence, or else the last result shown. Neither is
+    // cached.
+    private PipelineStage Fallback(FrameJob job)
+    {
+        job.Result = job.LocalFallback ?? lastDisplayedResult;
+        if (job.Result == null)
+        {
+            return null;
+        }
+        
+        FallbackFrames++;
+        if (job.LocalFallback == null)
+        {
+            // An older frame's boxes would seed the tracker at the wrong places.
+            job.TrackLuma = null;
+        }
+        return projectStage;
+    }
+    
+    // Novel frames wait out a short rate-limit deferral; repeats are dropped.
+    // A granted call is only sent once the month's count including it is on
+    // disk, so a crash mid-call cannot lose a billed transaction.
+    private async Task<bool> AcquireBudget(float novelty, CancellationToken cancellationToken)
+    {
+        while (true)
+        {
+            var decision = budget.TryAcquire(novelty, out TimeSpan wait);
+            if (decision == BudgetDecision.Granted)
+            {
+                if (await budget.WhenSaved())
+                {
+                    return true;
+                }
+                budget.Refund();
+                BudgetDeniedFrames++;
+                return false;
+            }
+            
+            if (decision == BudgetDecision.Denied || novelty < deferNovelty || wait.TotalSeconds > maxDeferSeconds)
+            {
+                BudgetDeniedFrames++;
+                return false;
+            }
+            
+            BudgetDeferredFrames++;
+            await Task.Delay(wait, cancellationToken);
+        }
+    }
+    
+    // Turns box centers into world-space anchors using the pose the frame was
+    // captured at, so a result is placed where the objects were even if the
+    // wearer has moved since. Cached results are pose-independent and are
+    // projected again for every frame that shows them.
+    private Task<PipelineStage> ProjectStage(FrameJob job)
+    {
+        job.Anchors = null;
+        if (!useSpatialAnchoring || !job.Pose.IsValid || job.Result.Count == 0)
+        {
+            return Task.FromResult(labelStage);
+        }
+
+        RefreshSpatialMesh();
+        long start = Stopwatch.GetTimestamp();
+        var result = job.Result;
+        var rectangles = result.Rectangles;
+        var anchors = new Vector3[result.Count];
+        for (int i = 0; i < anchors.Length; i++)
+        {
+            anchors[i] = ProjectToWorld(
+                job.Pose,
+                rectangles[i * 4] + rectangles[i * 4 + 2] * 0.5f,
+                rectangles[i * 4 + 1] + rectangles[i * 4 + 3] * 0.5f,
+                job.Resolution.width,
+                job.Resolution.height,
+                spatialMesh,
+                maxAnchorDistance,
+                fallbackAnchorDistance,
+                out bool onMesh);
+            if (onMesh)
+            {
+                MeshAnchoredDetections++;
+            }
+        }
+
+        anchorTicks += Stopwatch.GetTimestamp() - start;
+        AnchoredDetections += anchors.Length;
+        job.Anchors = anchors;
+        return Task.FromResult(labelStage);
+    }
+
+    // Mesh data can only be read on the main thread, so the observer's meshes
+    // are copied here and indexed on a worker; the previous index serves
+    // until the new one is ready.
+    private void RefreshSpatialMesh()
+    {
+        if (spatialMeshBuild != null && spatialMeshBuild.IsCompleted)
+        {
+            if (spatialMeshBuild.IsFaulted)
+            {
+                Debug.LogWarning($"Spatial mesh indexing failed: {spatialMeshBuild.Exception?.GetBaseException().Message}");
+            }
+            else if (!spatialMeshInjected)
+            {
+                spatialMesh = spatialMeshBuild.Result;
+            }
+            spatialMeshBuild = null;
+        }
+
+        if (spatialMeshInjected || spatialMeshBuild != null || Time.realtimeSinceStartup < nextSpatialMeshRefresh)
+        {
+            return;
+        }
+        nextSpatialMeshRefresh = Time.realtimeSinceStartup + spatialMeshRefreshSeconds;
+
+        var observer = CoreServices.GetSpatialAwarenessSystemDataProvider<IMixedRealitySpatialAwarenessMeshObserver>();
+        if (observer == null)
+        {
+            return;
+        }
+
+        var vertices = new List<Vector3>();
+        var indices = new List<int>();
+        foreach (var meshObject in observer.Meshes.Values)
+        {
+            var mesh = meshObject?.Filter?.sharedMesh;
+            if (mesh == null)
+            {
+                continue;
+            }
+
+            var localToWorld = meshObject.GameObject.transform.localToWorldMatrix;
+            int offset = vertices.Count;
+            foreach (var vertex in mesh.vertices)
+            {
+                vertices.Add(localToWorld.MultiplyPoint3x4(vertex));
+            }
+            foreach (int index in mesh.triangles)
+            {
+                indices.Add(offset + index);
+            }
+        }
+
+        if (indices.Count > 0)
+        {
+            spatialMeshBuild = Task.Run(() => SpatialMeshIndex.Build(vertices, indices));
+        }
+    }
+
+    private Task<PipelineStage> LabelStage(FrameJob job)
+    {
+        if (isDisposed)
+        {
+            return Task.FromResult<PipelineStage>(null);
+        }
+        
+        // Older frames still in flight would only overwrite this result with a
+        // staler one, so they are abandoned along with their remote calls.
+        // A result carried over from an earlier frame is no newer than what
+        // they are fetching, so it leaves them running.
+        if (job.IsFresh)
+        {
+            lock (activeJobs)
+            {
+                for (var node = activeJobs.First; node != null && node.Value.Sequence < job.Sequence; node = node.Next)
+                {
+                    if (node.Value.Cancel())
+                    {
+                        CancelledFrames++;
+                    }
+                }
+            }
+        }
+        
+        if (job.SceneThumbnail != null)
+        {
+            lastSceneThumbnail = job.SceneThumbnail;
+            lastSceneResult = job.Result;
+        }
+        lastDisplayedResult = job.Result;
+        if (job.TrackLuma != null && !job.IsTracked)
+        {
+            tracker.Seed(job.Result, job.TrackLuma, job.Resolution.width, job.Resolution.height);
+        }
+        if (!job.IsTracked && job.Result.Count > 0)
+        {
+            profileSelector?.RecordConfidence(job.Result.MeanConfidence);
+        }
+        labels.Show(job.Result, job.Anchors);
+        return Task.FromResult<PipelineStage>(null);
+    }
+
+    // Retries transient failures until MAX_RETRY_ATTEMPTS or the end-to-end
+    // deadline. The operation's token is cancelled when its attempt times out
+    // or the deadline passes. A retry that could not finish before the
+    // deadline is not started, and an open circuit fails the call at once.
+    // Cancelling cancellationToken aborts the attempt in flight or the backoff
+    // and surfaces as OperationCanceledException, not as a failure.
+    // beforeRetry, given the last failure, is asked before every retry and
+    // can veto it, in which case that failure is thrown.
+    private async Task<T> ProcessWithRetry<T>(
+        Func<CancellationToken, Task<T>> operation,
+        Func<Exception, CancellationToken, Task<bool>> beforeRetry,
+        CancellationToken cancellationToken)
+    {
+        var deadline = TimeSpan.FromSeconds(requestDeadlineSeconds);
+        var elapsed = Stopwatch.StartNew();
+        TimeSpan backoff = TimeSpan.FromSeconds(retryBaseDelaySeconds);
+        
+        using (var deadlineSource = CancellationTokenSource.CreateLinkedTokenSource(cancellationToken))
+        {
+            deadlineSource.CancelAfter(deadline);
+            for (int attempt = 0; ; attempt++)
+            {
+                if (!circuitBreaker.TryEnter())
+                {
+                    FailedFastCalls++;
+                    throw new CircuitOpenException();
+                }
+                
+                ExceptionDispatchInfo failure;
+                using (var attemptSource = CancellationTokenSource.CreateLinkedTokenSource(deadlineSource.Token))
+                {
+                    attemptSource.CancelAfter(TimeSpan.FromSeconds(perCallTimeoutSeconds));
+                    try
+                    {
+                        T result = await operation(attemptSource.Token);
+                        circuitBreaker.RecordSuccess();
+                        return result;
+                    }
+                    catch (OperationCanceledException) when (cancellationToken.IsCancellationRequested)
+                    {
+                        circuitBreaker.RecordAbandoned();
+                        throw;
+                    }
+                    catch (OperationCanceledException) when (attemptSource.IsCancellationRequested)
+                    {
+                        failure = ExceptionDispatchInfo.Capture(new TimeoutException(deadlineSource.IsCancellationRequested
+                            ? "Vision request deadline passed"
+                            : "Vision request attempt timed out"));
+                    }
+                    catch (Exception ex) when (IsTransientException(ex))
+                    {
+                        failure = ExceptionDispatchInfo.Capture(ex);
+                    }
+                    catch
+                    {
+                        // The service answered; the request itself was bad.
+                        circuitBreaker.RecordSuccess();
+                        throw;
+                    }
+                }
+                
+                // Throttling means the service is up, just busy, and says when to come back.
+                var throttled = failure.SourceException as VisionThrottledException;
+                if (throttled != null)
+                {
+                    circuitBreaker.RecordSuccess();
+                }
+                else
+                {
+                    circuitBreaker.RecordFailure();
+                }
+                
+                backoff = throttled?.RetryAfter ?? NextBackoff(backoff);
+                if (attempt + 1 >= MAX_RETRY_ATTEMPTS || elapsed.Elapsed + backoff >= deadline)
+                {
+                    failure.Throw();
+                }
+                
+                await Task.Delay(backoff, cancellationToken);
+                if (beforeRetry != null && !await beforeRetry(failure.SourceException, cancellationToken))
+                {
+                    failure.Throw();
+                }
+                RetryAttempts++;
+            }
+        }
+    }
+    
+    // Decorrelated jitter: uniform between the base delay and three times
+    // the previous one, capped. Spreads retries from many clients without
+    // the long tail of full exponential backoff.
+    private TimeSpan NextBackoff(TimeSpan previous)
+    {
+        double baseSeconds = retryBaseDelaySeconds;
+        double upper = Math.Max(baseSeconds, previous.TotalSeconds * 3);
+        double sample;
+        lock (retryJitter)
+        {
+            sample = baseSeconds + retryJitter.NextDouble() * (upper - baseSeconds);
+        }
+        return TimeSpan.FromSeconds(Math.Min(retryMaxDelaySeconds, sample));
+    }
+
+    // Failures worth another attempt: timeouts, dropped or refused
+    // connections, and throttling. Anything else is an answer from the
+    // service that a retry would only repeat.
+    private bool IsTransientException(Exception ex)
+    {
+        return ex is TimeoutException || ex is IOException || ex is HttpRequestException || ex is VisionThrottledException;
+    }
+    
+    // Drives recorded frames through the same capture, hash, cache, analyze and
+    // display path as live capture and reports end-to-end latency. Intended for
+    // offline load tests against a MockVisionBackend.
+    // maxOutstanding > 1 keeps several requests queued, exercising the
+    // pipeline's overlap and drop policy instead of one frame at a time.
+    // poses, if given, holds the recorded camera pose of each frame.
+    // Each frame is copied into a capture buffer as CaptureImage does.
+    // Allocation is counted on the calling thread, where Unity resumes every
+    // stage, plus everything RunOnWorker runs on pool threads (conversion,
+    // hashing, tracking, local detection, downscaling and encoding); .NET
+    // Standard 2.1 has no process-wide counter. With compareCopyPath, frames go in
+    // alternating batches of maxOutstanding with FrameBuffer pooling on and
+    // off; each batch is drained before the next starts, so its allocation is
+    // charged to its own path.
+    public async Task<LoadReport> RunReplayLoad(
+        IReadOnlyList<byte[]> frames, Resolution frameResolution, int maxOutstanding = 1, IReadOnlyList<CameraPose> poses = null,
+        bool compareCopyPath = false)
+    {
+        var previousCapture = captureFrame;
+        bool previousPooling = FrameBuffer.Pooling;
+        var latencies = new LatencyRecorder(frames.Count);
+        var outstanding = new List<Task<bool>>(maxOutstanding);
+        int batchSize = Math.Max(1, maxOutstanding);
+        int displayed = 0;
+        int next = 0;
+        
+        captureFrame = () =>
+        {
+            int index = Math.Min(next++, frames.Count - 1);
+            var pose = poses != null && index < poses.Count ? poses[index] : default;
+            var frame = FrameBuffer.Rent(frames[index].Length);
+            Buffer.BlockCopy(frames[index], 0, frame.Array, 0, frames[index].Length);
+            return Task.FromResult((frame, pose, frameResolution));
+        };
+        
+        // Index 0 is the pooled path, 1 the copy path.
+        var allocated = new long[2];
+        var submittedFrames = new int[2];
+        int path = 0;
+        int gen0Before = GC.CollectionCount(0);
+        long allocatedMark = CountedAllocatedBytes();
+        var total = Stopwatch.StartNew();
+        try
+        {
+            for (int submitted = 0; submitted < frames.Count && next < frames.Count; submitted++)
+            {
+                if (compareCopyPath && submitted > 0 && submitted % batchSize == 0)
+                {
+                    foreach (bool shown in await Task.WhenAll(outstanding))
+                    {
+                        if (shown) displayed++;
+                    }
+                    outstanding.Clear();
+                    
+                    long now = CountedAllocatedBytes();
+                    allocated[path] += now - allocatedMark;
+                    allocatedMark = now;
+                    path = 1 - path;
+                    FrameBuffer.Pooling = path == 0;
+                }
+                
+                if (outstanding.Count >= maxOutstanding)
+                {
+                    var finished = await Task.WhenAny(outstanding);
+                    outstanding.Remove(finished);
+                    if (finished.Result) displayed++;
+                }
+                submittedFrames[path]++;
+                outstanding.Add(TimeRequest(latencies, total));
+            }
+            
+            foreach (bool shown in await Task.WhenAll(outstanding))
+            {
+                if (shown) displayed++;
+            }
+            allocated[path] += CountedAllocatedBytes() - allocatedMark;
+        }
+        finally
+        {
+            captureFrame = previousCapture;
+            FrameBuffer.Pooling = previousPooling;
+        }
+        
+        return new LoadReport(
+            displayed,
+            latencies.PercentileMilliseconds(50),
+            latencies.PercentileMilliseconds(99),
+            total.Elapsed)
+        {
+            AllocatedBytesPerFrame = submittedFrames[0] > 0 ? allocated[0] / submittedFrames[0] : 0,
+            CopyPathBytesPerFrame = submittedFrames[1] > 0 ? allocated[1] / submittedFrames[1] : 0,
+            Gen0Collections = GC.CollectionCount(0) - gen0Before
+        };
+    }
+    
+    // Projects raysPerPose random pixels from each recorded pose onto a
+    // recorded mesh, exactly as the project stage does, and reports the
+    // throughput. Needs no device, camera or backend.
+    public static RaycastBenchmarkReport BenchmarkAnchoring(
+        SpatialMeshIndex mesh, IReadOnlyList<CameraPose> poses, Resolution resolution,
+        int raysPerPose = 1000, float maxDistance = 10f, int seed = 1)
+    {
+        var random = new System.Random(seed);
+        var pixels = new float[raysPerPose * 2];
+        int hits = 0;
+        long ticks = 0;
+        foreach (var pose in poses)
+        {
+            for (int i = 0; i < pixels.Length; i += 2)
+            {
+                pixels[i] = (float)random.NextDouble() * resolution.width;
+                pixels[i + 1] = (float)random.NextDouble() * resolution.height;
+            }
+
+            long start = Stopwatch.GetTimestamp();
+            for (int i = 0; i < pixels.Length; i += 2)
+            {
+                ProjectToWorld(pose, pixels[i], pixels[i + 1], resolution.width, resolution.height,
+                    mesh, maxDistance, maxDistance, out bool onMesh);
+                if (onMesh) hits++;
+            }
+            ticks += Stopwatch.GetTimestamp() - start;
+        }
+
+        return new RaycastBenchmarkReport
+        {
+            Triangles = mesh.TriangleCount,
+            Rays = poses.Count * raysPerPose,
+            MeshHits = hits,
+            Seconds = (double)ticks / Stopwatch.Frequency
+        };
+    }
+
+    // Runs the tracker over a recorded sequence with ground-truth boxes
+    // (listed in the same order on every frame). Whenever the tracker gives
+    // up, the frame's ground truth stands in for a remote analysis and seeds
+    // it again; every other frame is tracked, and its boxes' centers are
+    // compared with the truth.
+    public static TrackerReport EvaluateTracker(
+        IReadOnlyList<byte[]> frames, Resolution resolution, IReadOnlyList<IList<DetectedObject>> groundTruth,
+        int maxFrames = 15, float minConfidence = 0.5f)
+    {
+        var tracker = new ObjectTracker();
+        var report = new TrackerReport { Frames = frames.Count };
+        double totalDrift = 0;
+        int driftSamples = 0;
+        long ticks = 0;
+        for (int frame = 0; frame < frames.Count; frame++)
+        {
+            long start = Stopwatch.GetTimestamp();
+            var luma = ObjectTracker.SampleLuma(frames[frame], resolution.width, resolution.height);
+            var tracked = tracker.Track(luma, resolution.width, resolution.height, maxFrames, minConfidence);
+            ticks += Stopwatch.GetTimestamp() - start;
+            
+            var truth = groundTruth[frame];
+            if (tracked == null)
+            {
+                report.AnalysisCalls++;
+                tracker.Seed(new DetectionResult(truth), luma, resolution.width, resolution.height);
+                continue;
+            }
+            
+            var rectangles = tracked.Rectangles;
+            for (int i = 0; i < tracked.Count; i++)
+            {
+                var rectangle = truth[i].Rectangle;
+                double dx = rectangles[i * 4] + rectangles[i * 4 + 2] * 0.5 - (rectangle.X + rectangle.W * 0.5);
+                double dy = rectangles[i * 4 + 1] + rectangles[i * 4 + 3] * 0.5 - (rectangle.Y + rectangle.H * 0.5);
+                double drift = Math.Sqrt(dx * dx + dy * dy);
+                totalDrift += drift;
+                driftSamples++;
+                report.MaxDriftPixels = Math.Max(report.MaxDriftPixels, drift);
+            }
+        }
+        
+        report.MeanDriftPixels = driftSamples > 0 ? totalDrift / driftSamples : 0;
+        report.MicrosecondsPerFrame = frames.Count > 0 ? ticks * 1e6 / Stopwatch.Frequency / frames.Count : 0;
+        return report;
+    }
+    
+    // Replays a recorded sequence through two caches that start empty: one
+    // keyed on exact Murmur128 frame hashes, one on perceptual hashes matched
+    // within maxDistance. Every miss stands for a billed call whose result is
+    // then cached. The perceptual index is first padded with
+    // backgroundEntries random hashes, which are too far apart to match
+    // anything, so lookup latency is measured at a realistic index size.
+    public static PerceptualKeyBenchmarkReport BenchmarkPerceptualKeys(
+        IReadOnlyList<byte[]> frames, Resolution resolution, int maxDistance = 6, int backgroundEntries = 20000, int seed = 1)
+    {
+        var random = new System.Random(seed);
+        var index = new PerceptualHashIndex();
+        var buffer = new byte[8];
+        for (int i = 0; i < backgroundEntries; i++)
+        {
+            random.NextBytes(buffer);
+            index.Add(BitConverter.ToUInt64(buffer, 0));
+        }
+        
+        var exactKeys = new CacheKeyTable<bool>();
+        var lookups = new LatencyRecorder(frames.Count);
+        var report = new PerceptualKeyBenchmarkReport { Frames = frames.Count, IndexEntries = index.Count };
+        long exactTicks = 0;
+        long perceptualTicks = 0;
+        foreach (var frame in frames)
+        {
+            long start = Stopwatch.GetTimestamp();
+            var key = FrameHasher.Hash(frame, CacheKeyHash.Murmur128, null);
+            exactTicks += Stopwatch.GetTimestamp() - start;
+            if (exactKeys.TryGetValue(key, out _))
+            {
+                report.ExactHits++;
+            }
+            else
+            {
+                exactKeys.Set(key, true);
+            }
+            
+            start = Stopwatch.GetTimestamp();
+            bool hashed = TryCalculatePerceptualHash(frame, resolution.width, resolution.height, out ulong hash);
+            long hashedAt = Stopwatch.GetTimestamp();
+            perceptualTicks += hashedAt - start;
+            if (!hashed)
+            {
+                continue;
+            }
+            
+            bool found = index.TryFindNearest(hash, maxDistance, out _, out int distance);
+            lookups.Record(Stopwatch.GetTimestamp() - hashedAt);
+            if (found)
+            {
+                report.PerceptualHits++;
+                if (distance > 0) report.NearDuplicateHits++;
+            }
+            else
+            {
+                index.Add(hash);
+            }
+        }
+        
+        double microsecondsPerTick = 1e6 / Stopwatch.Frequency;
+        report.ExactHashMicroseconds = frames.Count > 0 ? exactTicks * microsecondsPerTick / frames.Count : 0;
+        report.PerceptualHashMicroseconds = frames.Count > 0 ? perceptualTicks * microsecondsPerTick / frames.Count : 0;
+        report.LookupP50Microseconds = lookups.PercentileMilliseconds(50) * 1000;
+        report.LookupP99Microseconds = lookups.PercentileMilliseconds(99) * 1000;
+        return report;
+    }
+    
+    // Runs the local model at modelPath over a recorded sequence, the way
+    // TryLocalProcessing does, and counts the frames it would resolve at
+    // confidenceThreshold (the localConfidenceThreshold it is tuned against).
+    // Each of those frames is one billed call that the backend does not
+    // receive. The first frame only warms the model up and is not counted.
+    public static LocalDetectorBenchmarkReport BenchmarkLocalDetector(
+        string modelPath, IReadOnlyList<byte[]> frames, Resolution resolution, float confidenceThreshold = 0.6f)
+    {
+        var detector = Int8Detector.Load(modelPath);
+        if (frames.Count > 0)
+        {
+            detector.Detect(frames[0], resolution.width, resolution.height);
+        }
+        
+        var latencies = new LatencyRecorder(frames.Count);
+        var report = new LocalDetectorBenchmarkReport { Frames = frames.Count - Math.Min(1, frames.Count) };
+        for (int i = 1; i < frames.Count; i++)
+        {
+            long start = Stopwatch.GetTimestamp();
+            var detections = detector.Detect(frames[i], resolution.width, resolution.height);
+            latencies.Record(Stopwatch.GetTimestamp() - start);
+            if (detections.Count == 0)
+            {
+                continue;
+            }
+            
+            report.FramesWithDetections++;
+            if (new DetectionResult(detections).MinimumConfidence >= confidenceThreshold)
+            {
+                report.ResolvedLocally++;
+            }
+        }
+        
+        report.InferenceP50Milliseconds = latencies.PercentileMilliseconds(50);
+        report.InferenceP99Milliseconds = latencies.PercentileMilliseconds(99);
+        return report;
+    }
+    
+    // Hash throughput for a width x height BGRA32 frame: SHA-256 with a new
+    // hasher per frame (as before), SHA-256 reusing this thread's hasher,
+    // and Murmur128. Per-frame times are what an exact key costs on the
+    // critical path without overlapHashing; compare HashWaitMicroseconds
+    // from a replay to see what is left with it.
+    public static HashBenchmarkReport BenchmarkHashing(int width = 1280, int height = 720, int frames = 50, int seed = 1)
+    {
+        var frame = new byte[width * height * 4];
+        new System.Random(seed).NextBytes(frame);
+        
+        double Measure(Action hash)
+        {
+            hash();
+            var clock = Stopwatch.StartNew();
+            for (int i = 0; i < frames; i++)
+            {
+                hash();
+            }
+            return clock.Elapsed.TotalMilliseconds / frames;
+        }
+        
+        double perCall = Measure(() =>
+        {
+            using (var sha = SHA256.Create())
+            {
+                sha.ComputeHash(frame, 0, frame.Length);
+            }
+        });
+        double reused = Measure(() => FrameHasher.Hash(frame, CacheKeyHash.Sha256, null));
+        double murmur = Measure(() => FrameHasher.Hash(frame, CacheKeyHash.Murmur128, null));
+        
+        double GigabytesPerSecond(double milliseconds) => milliseconds > 0 ? frame.Length / (milliseconds * 1e6) : 0;
+        return new HashBenchmarkReport
+        {
+            FrameBytes = frame.Length,
+            Frames = frames,
+            Sha256PerCallMilliseconds = perCall,
+            Sha256Milliseconds = reused,
+            Murmur128Milliseconds = murmur,
+            Sha256PerCallGigabytesPerSecond = GigabytesPerSecond(perCall),
+            Sha256GigabytesPerSecond = GigabytesPerSecond(reused),
+            Murmur128GigabytesPerSecond = GigabytesPerSecond(murmur)
+        };
+    }
+    
+    // Inserts `entries` random SHA-256 digests, then looks up `lookups` of
+    // them, once with Base64 string keys in a Dictionary (as cache keys were
+    // before) and once with CacheKey in a CacheKeyTable. Times include
+    // turning the digest into a key, which is where the strings allocate.
+    public static CacheKeyBenchmarkReport BenchmarkCacheKeys(int entries, int lookups = 1000000, int seed = 1)
+    {
+        var random = new System.Random(seed);
+        var digests = new byte[entries * 32];
+        random.NextBytes(digests);
+        var order = new int[lookups];
+        for (int i = 0; i < lookups; i++)
+        {
+            order[i] = random.Next(entries);
+        }
+        
+        var strings = new Dictionary<string, DetectionResult>();
+        var table = new CacheKeyTable<DetectionResult>();
+        int found = 0;
+        
+        var clock = Stopwatch.StartNew();
+        for (int i = 0; i < entries; i++)
+        {
+            strings[Convert.ToBase64String(digests, i * 32, 32)] = null;
+        }
+        double stringInsert = clock.Elapsed.TotalMilliseconds;
+        
+        clock.Restart();
+        for (int i = 0; i < entries; i++)
+        {
+            table.Set(CacheKey.FromSha256(new ReadOnlySpan<byte>(digests, i * 32, 32)), null);
+        }
+        double binaryInsert = clock.Elapsed.TotalMilliseconds;
+        
+        long allocatedBefore = GC.GetAllocatedBytesForCurrentThread();
+        clock.Restart();
+        for (int i = 0; i < lookups; i++)
+        {
+            if (strings.TryGetValue(Convert.ToBase64String(digests, order[i] * 32, 32), out _)) found++;
+        }
+        double stringLookup = clock.Elapsed.TotalMilliseconds;
+        long stringBytes = GC.GetAllocatedBytesForCurrentThread() - allocatedBefore;
+        
+        allocatedBefore = GC.GetAllocatedBytesForCurrentThread();
+        clock.Restart();
+        for (int i = 0; i < lookups; i++)
+        {
+            if (table.TryGetValue(CacheKey.FromSha256(new ReadOnlySpan<byte>(digests, order[i] * 32, 32)), out _)) found++;
+        }
+        double binaryLookup = clock.Elapsed.TotalMilliseconds;
+        long binaryBytes = GC.GetAllocatedBytesForCurrentThread() - allocatedBefore;
+        
+        if (found != 2 * lookups || table.Count != strings.Count)
+        {
+            throw new InvalidOperationException("Cache key tables disagree");
+        }
+        
+        return new CacheKeyBenchmarkReport
+        {
+            Entries = entries,
+            Lookups = lookups,
+            StringInsertNanoseconds = entries > 0 ? stringInsert * 1e6 / entries : 0,
+            BinaryInsertNanoseconds = entries > 0 ? binaryInsert * 1e6 / entries : 0,
+            StringLookupNanoseconds = lookups > 0 ? stringLookup * 1e6 / lookups : 0,
+            BinaryLookupNanoseconds = lookups > 0 ? binaryLookup * 1e6 / lookups : 0,
+            StringBytesPerLookup = lookups > 0 ? (double)stringBytes / lookups : 0,
+            BinaryBytesPerLookup = lookups > 0 ? (double)binaryBytes / lookups : 0
+        };
+    }
+    
+    // Per-call cost of the expiry sweep CleanExpiredCache runs on every frame,
+    // at each cache size in `sizes`. Results are stamped one tick apart, so
+    // each call expires exactly the oldest entry and caches one new result
+    // and the size holds steady; both caches are checked to hold `entries`
+    // results before and after the timed calls. The same calls are timed
+    // against a plain dictionary swept with a LINQ scan, as expiry worked
+    // before.
+    public static IReadOnlyList<CacheExpiryBenchmarkReport> BenchmarkCacheExpiry(IReadOnlyList<int> sizes, int calls = 1000)
+    {
+        var reports = new List<CacheExpiryBenchmarkReport>();
+        foreach (int entries in sizes)
+        {
+            var keys = new CacheKey[entries + calls];
+            for (int i = 0; i < keys.Length; i++)
+            {
+                keys[i] = CacheKey.FromMurmur128((ulong)i * 0x9E3779B97F4A7C15UL + 1, (ulong)i);
+            }
+            
+            var epoch = DateTime.Now;
+            var values = new DetectionResult[keys.Length];
+            for (int i = 0; i < values.Length; i++)
+            {
+                values[i] = DetectionResult.Empty(epoch.AddTicks(i));
+            }
+            
+            double Measure(Action<CacheKey, DetectionResult> set, Action<DateTime> removeExpired, Func<int> count, out long allocatedPerCall)
+            {
+                for (int i = 0; i < entries; i++)
+                {
+                    set(keys[i], values[i]);
+                }
+                if (count() != entries)
+                {
+                    throw new InvalidOperationException($"Expiry benchmark started with {count()} of {entries} entries");
+                }
+                
+                long allocatedBefore = GC.GetAllocatedBytesForCurrentThread();
+                var clock = Stopwatch.StartNew();
+                for (int i = 0; i < calls; i++)
+                {
+                    removeExpired(values[i].Timestamp.AddTicks(1));
+                    set(keys[entries + i], values[entries + i]);
+                }
+                double microseconds = clock.Elapsed.TotalMilliseconds * 1000 / calls;
+                allocatedPerCall = (GC.GetAllocatedBytesForCurrentThread() - allocatedBefore) / calls;
+                if (count() != entries)
+                {
+                    throw new InvalidOperationException($"Expiry benchmark ended with {count()} of {entries} entries");
+                }
+                return microseconds;
+            }
+            
+            // Uncapped, so only expiry removes entries.
+            var cache = new DetectionCache(int.MaxValue, long.MaxValue, null);
+            double heap = Measure((key, value) => cache.Set(key, value), cutoff => cache.RemoveExpired(cutoff),
+                () => cache.Count, out long heapBytes);
+            
+            var dictionary = new Dictionary<CacheKey, DetectionResult>();
+            double scan = Measure((key, value) => dictionary[key] = value, cutoff =>
+            {
+                var expired = dictionary.Where(kv => kv.Value.Timestamp < cutoff).Select(kv => kv.Key).ToList();
+                foreach (var key in expired)
+                {
+                    dictionary.Remove(key);
+                }
+            }, () => dictionary.Count, out long scanBytes);
+            
+            reports.Add(new CacheExpiryBenchmarkReport
+            {
+                Entries = entries,
+                Calls = calls,
+                HeapMicroseconds = heap,
+                ScanMicroseconds = scan,
+                HeapBytesPerCall = heapBytes,
+                ScanBytesPerCall = scanBytes
+            });
+        }
+        return reports;
+    }
+    
+    // Simulates `sessions` app launches against a persistent cache file at
+    // `path`, which is deleted first. Each session reopens the file, looks up
+    // `lookupsPerSession` keys (revisitFraction of them seen in an earlier
+    // session, the rest new) and appends every miss, as an analyzed frame
+    // would. Reports how long opening and indexing took, the first hit after
+    // the index is ready (cold pages), steady lookups, and the hit rate
+    // carried over from earlier sessions.
+    public static IReadOnlyList<PersistentCacheReport> BenchmarkPersistentCache(
+        string path, int sessions = 5, int lookupsPerSession = 2000, double revisitFraction = 0.5, int detections = 4, int seed = 1)
+    {
+        File.Delete(path);
+        var random = new System.Random(seed);
+        var objects = new DetectedObject[detections];
+        for (int i = 0; i < detections; i++)
+        {
+            objects[i] = new DetectedObject
+            {
+                ObjectProperty = $"object {i}",
+                Confidence = 0.9,
+                Rectangle = new BoundingRect { X = i * 100, Y = 100, W = 80, H = 80 }
+            };
+        }
+        var value = new DetectionResult(objects);
+        
+        var seen = new List<CacheKey>();
+        ulong nextKey = 1;
+        var reports = new List<PersistentCacheReport>();
+        for (int session = 0; session < sessions; session++)
+        {
+            var cutoff = DateTime.Now.AddHours(-CACHE_EXPIRATION_HOURS);
+            var clock = Stopwatch.StartNew();
+            var store = new PersistentDetectionStore(path, cutoff);
+            double openMilliseconds = clock.Elapsed.TotalMilliseconds;
+            store.LoadTask.Wait();
+            double indexMilliseconds = clock.Elapsed.TotalMilliseconds;
+            
+            var report = new PersistentCacheReport
+            {
+                Session = session + 1,
+                Lookups = lookupsPerSession,
+                OpenMilliseconds = openMilliseconds,
+                IndexMilliseconds = indexMilliseconds,
+                FileBytes = File.Exists(path) ? new FileInfo(path).Length : 0
+            };
+            var lookups = new LatencyRecorder(lookupsPerSession);
+            int seenBefore = seen.Count;
+            for (int i = 0; i < lookupsPerSession; i++)
+            {
+                bool revisit = seenBefore > 0 && random.NextDouble() < revisitFraction;
+                var key = revisit
+                    ? seen[random.Next(seenBefore)]
+                    : CacheKey.FromMurmur128(nextKey * 0x9E3779B97F4A7C15UL, nextKey++);
+                if (revisit) report.Revisits++;
+                
+                long start = Stopwatch.GetTimestamp();
+                bool hit = store.TryRead(key, cutoff, out _);
+                long elapsed = Stopwatch.GetTimestamp() - start;
+                lookups.Record(elapsed);
+                if (hit)
+                {
+                    if (report.Hits++ == 0)
+                    {
+                        report.FirstHitMicroseconds = elapsed * 1e6 / Stopwatch.Frequency;
+                    }
+                }
+                else
+                {
+                    store.Append(key, value);
+                    seen.Add(key);
+                }
+            }
+            report.LookupP50Microseconds = lookups.PercentileMilliseconds(50) * 1000;
+            report.LookupP99Microseconds = lookups.PercentileMilliseconds(99) * 1000;
+            reports.Add(report);
+            
+            store.Dispose();
+            store.Closed.Wait();
+        }
+        return reports;
+    }
+    
+    // Hammers one result cache from `threads` threads with a mix of lookups
+    // (80%), inserts and expiry sweeps over `keys` keys, with caps small
+    // enough to force eviction. Every value is tied to its key, so a lookup
+    // that returns another key's value counts as a mismatch. Values are
+    // stamped across a one-second window and each sweep's cutoff steps
+    // through its oldest quarter, wrapping around, so sweeps remove entries
+    // while other threads read and insert, and the newer three quarters
+    // still fill the cache up to its caps. Afterwards each shard's table,
+    // recency list and expiry heap are checked against each other, and a run
+    // whose sweeps expired nothing throws.
+    public static CacheStressReport StressCache(int threads, int operationsPerThread = 200000, int keys = 4096, int seed = 1)
+    {
+        const int cutoffSteps = 64;
+        var epoch = DateTime.Now;
+        long window = TimeSpan.TicksPerSecond;
+        var stamps = new System.Random(seed);
+        var values = new DetectionResult[keys];
+        var cacheKeys = new CacheKey[keys];
+        for (int i = 0; i < keys; i++)
+        {
+            values[i] = DetectionResult.Empty(epoch.AddTicks((long)(stamps.NextDouble() * window)));
+            cacheKeys[i] = CacheKey.FromMurmur128((ulong)i * 0x9E3779B97F4A7C15UL + 1, (ulong)i);
+        }
+        
+        long evictions = 0;
+        long expirations = 0;
+        long sweeps = 0;
+        var cache = new DetectionCache(keys / 2, long.MaxValue, (key, expired) =>
+        {
+            if (expired)
+            {
+                Interlocked.Increment(ref expirations);
+            }
+            else
+            {
+                Interlocked.Increment(ref evictions);
+            }
+        });
+        long hits = 0;
+        long mismatches = 0;
+        var clock = Stopwatch.StartNew();
+        var workers = new Task[threads];
+        for (int t = 0; t < threads; t++)
+        {
+            int workerSeed = seed * 7919 + t;
+            workers[t] = Task.Factory.StartNew(() =>
+            {
+                var random = new System.Random(workerSeed);
+                for (int i = 0; i < operationsPerThread; i++)
+                {
+                    int k = random.Next(keys);
+                    int operation = random.Next(100);
+                    if (operation < 80)
+                    {
+                        if (cache.TryGetValue(cacheKeys[k], out DetectionResult value))
+                        {
+                            Interlocked.Increment(ref hits);
+                            if (value != values[k])
+                            {
+                                Interlocked.Increment(ref mismatches);
+                            }
+                        }
+                    }
+                    else if (operation < 99)
+                    {
+                        cache.Set(cacheKeys[k], values[k]);
+                    }
+                    else
+                    {
+                        long step = Interlocked.Increment(ref sweeps) % cutoffSteps + 1;
+                        cache.RemoveExpired(epoch.AddTicks(window / 4 * step / cutoffSteps));
+                    }
+                }
+            }, TaskCreationOptions.LongRunning);
+        }
+        Task.WaitAll(workers);
+        if (sweeps > 0 && expirations == 0)
+        {
+            throw new InvalidOperationException($"{sweeps} expiry sweeps removed nothing");
+        }
+        
+        return new CacheStressReport
+        {
+            Threads = threads,
+            Operations = (long)threads * operationsPerThread,
+            Hits = hits,
+            Evictions = evictions,
+            Expirations = expirations,
+            Mismatches = mismatches,
+            Consistent = cache.Validate(),
+            Milliseconds = clock.Elapsed.TotalMilliseconds
+        };
+    }
+    
+    // Lookups per second on a warm cache of `entries` results from 1 up to
+    // maxThreads threads, for the sharded cache and for a single shard (one
+    // lock, as a plain locked cache would have).
+    public static IReadOnlyList<CacheScalingReport> BenchmarkCacheScaling(int maxThreads, int entries = 10000, int lookupsPerThread = 1000000, int seed = 1)
+    {
+        var cacheKeys = new CacheKey[entries];
+        var random = new System.Random(seed);
+        for (int i = 0; i < entries; i++)
+        {
+            cacheKeys[i] = CacheKey.FromMurmur128(((ulong)random.Next() << 32) | (uint)random.Next(), (ulong)i);
+        }
+        
+        // Powers of two, then maxThreads itself if it is not one.
+        var threadCounts = new List<int>();
+        for (int threads = 1; threads <= maxThreads; threads *= 2)
+        {
+            threadCounts.Add(threads);
+        }
+        if (threadCounts.Count > 0 && threadCounts[threadCounts.Count - 1] != maxThreads)
+        {
+            threadCounts.Add(maxThreads);
+        }
+        
+        var reports = new List<CacheScalingReport>();
+        foreach (int shardCount in new[] { 1, 16 })
+        {
+            var cache = new DetectionCache(entries, long.MaxValue, null, shardCount);
+            foreach (var key in cacheKeys)
+            {
+                cache.Set(key, new DetectionResult(Array.Empty<DetectedObject>()));
+            }
+            
+            foreach (int threads in threadCounts)
+            {
+                var start = new ManualResetEventSlim();
+                var workers = new Task[threads];
+                for (int t = 0; t < threads; t++)
+                {
+                    int offset = t * 7919;
+                    workers[t] = Task.Factory.StartNew(() =>
+                    {
+                        start.Wait();
+                        for (int i = 0; i < lookupsPerThread; i++)
+                        {
+                            cache.TryGetValue(cacheKeys[(offset + i) % entries], out _);
+                        }
+                    }, TaskCreationOptions.LongRunning);
+                }
+                
+                var clock = Stopwatch.StartNew();
+                start.Set();
+                Task.WaitAll(workers);
+                reports.Add(new CacheScalingReport
+                {
+                    Threads = threads,
+                    Shards = shardCount,
+                    LookupsPerSecond = (double)threads * lookupsPerThread / clock.Elapsed.TotalSeconds
+                });
+            }
+        }
+        return reports;
+    }
+    
+    // Shows frames of `detections` objects through the label manager and
+    // reports the time and main-thread allocation per frame. Objects drift a
+    // little every frame and a tenth of them are replaced by new ones.
+    // Creates Unity objects, so call it from the main thread (e.g. in play
+    // mode); results are built up front and not counted.
+    public static LabelBenchmarkReport BenchmarkLabels(int detections, int frames = 300, int seed = 1)
+    {
+        var random = new System.Random(seed);
+        var scene = new DetectedObject[detections];
+        var positions = new Vector3[detections];
+        var results = new DetectionResult[frames];
+        var anchors = new Vector3[frames][];
+        for (int frame = 0; frame < frames; frame++)
+        {
+            for (int i = 0; i < detections; i++)
+            {
+                if (frame == 0 || random.Next(10) == 0)
+                {
+                    scene[i] = new DetectedObject
+                    {
+                        ObjectProperty = $"object {random.Next(32)}",
+                        Confidence = 0.5 + random.NextDouble() * 0.5,
+                        Rectangle = new BoundingRect
+                        {
+                            X = random.Next(1200),
+                            Y = random.Next(640),
+                            W = 80,
+                            H = 80
+                        }
+                    };
+                    positions[i] = new Vector3((float)random.NextDouble() * 8 - 4, (float)random.NextDouble() * 2, (float)random.NextDouble() * 8 - 4);
+                }
+                else
+                {
+                    positions[i] = new Vector3(
+                        positions[i].x + (float)(random.NextDouble() - 0.5) * 0.02f,
+                        positions[i].y,
+                        positions[i].z + (float)(random.NextDouble() - 0.5) * 0.02f);
+                }
+            }
+            results[frame] = new DetectionResult(scene);
+            anchors[frame] = (Vector3[])positions.Clone();
+        }
+
+        var manager = new LabelManager();
+        var latencies = new LatencyRecorder(frames);
+        long allocatedBefore = GC.GetAllocatedBytesForCurrentThread();
+        long totalTicks = 0;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            long start = Stopwatch.GetTimestamp();
+            manager.Show(results[frame], anchors[frame]);
+            manager.Apply();
+            long elapsed = Stopwatch.GetTimestamp() - start;
+            latencies.Record(elapsed);
+            totalTicks += elapsed;
+        }
+        long allocated = GC.GetAllocatedBytesForCurrentThread() - allocatedBefore;
+
+        var report = new LabelBenchmarkReport
+        {
+            Detections = detections,
+            Frames = frames,
+            MeanMilliseconds = frames > 0 ? totalTicks * 1000.0 / Stopwatch.Frequency / frames : 0,
+            P99Milliseconds = latencies.PercentileMilliseconds(99),
+            AllocatedBytesPerFrame = frames > 0 ? allocated / frames : 0,
+            CreatedLabels = manager.CreatedLabels,
+            TextUpdates = manager.TextUpdates
+        };
+        manager.Clear();
+        return report;
+    }
+    
+    // Builds `results` cached results of `detections` objects each, once as
+    // DetectionResult and once as the old per-result list of
+    // (label, confidence, location) tuples with a fresh label string per
+    // detection, as SDK responses and disk reads produced them. Reports the
+    // retained bytes per entry and the time to walk every result the way
+    // LabelManager.Apply reads one (label, confidence, position).
+    public static ResultMemoryBenchmarkReport BenchmarkResultMemory(int results = 10000, int detections = 4, int passes = 50, int seed = 1)
+    {
+        var random = new System.Random(seed);
+        var sources = new DetectedObject[results][];
+        for (int r = 0; r < results; r++)
+        {
+            sources[r] = new DetectedObject[detections];
+            for (int i = 0; i < detections; i++)
+            {
+                sources[r][i] = new DetectedObject
+                {
+                    ObjectProperty = $"object {random.Next(32)}",
+                    Confidence = 0.5 + random.NextDouble() * 0.5,
+                    Rectangle = new BoundingRect { X = random.Next(1200), Y = random.Next(640), W = 80, H = 80 }
+                };
+            }
+        }
+        
+        long before = GC.GetTotalMemory(true);
+        var legacy = new Tuple<List<(string, double, Vector3)>, DateTime>[results];
+        for (int r = 0; r < results; r++)
+        {
+            var list = new List<(string, double, Vector3)>(detections);
+            foreach (var obj in sources[r])
+            {
+                list.Add((new string(obj.ObjectProperty.ToCharArray()), obj.Confidence,
+                    new Vector3(obj.Rectangle.X, obj.Rectangle.Y, 0)));
+            }
+            legacy[r] = Tuple.Create(list, DateTime.Now);
+        }
+        long legacyBytes = GC.GetTotalMemory(true) - before;
+        
+        before = GC.GetTotalMemory(true);
+        var compact = new DetectionResult[results];
+        for (int r = 0; r < results; r++)
+        {
+            compact[r] = new DetectionResult(sources[r]);
+        }
+        long compactBytes = GC.GetTotalMemory(true) - before;
+        GC.KeepAlive(sources);
+        
+        // Both walks sum every box corner and confidence, which the two forms
+        // store exactly alike, and count labels, so a mismatch means one walk
+        // skipped something.
+        double legacySum = 0;
+        double compactSum = 0;
+        long legacyLabels = 0;
+        long compactLabels = 0;
+        var clock = Stopwatch.StartNew();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            foreach (var entry in legacy)
+            {
+                foreach (var (label, confidence, location) in entry.Item1)
+                {
+                    legacySum += location.x + location.y + (float)confidence;
+                    if (label != null) legacyLabels++;
+                }
+            }
+        }
+        double legacyMilliseconds = clock.Elapsed.TotalMilliseconds / Math.Max(1, passes);
+        
+        clock.Restart();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            foreach (var result in compact)
+            {
+                var labels = result.LabelIds;
+                var confidences = result.Confidences;
+                var rectangles = result.Rectangles;
+                for (int i = 0; i < result.Count; i++)
+                {
+                    compactSum += rectangles[i * 4] + rectangles[i * 4 + 1] + confidences[i];
+                    if (labels[i] != 0) compactLabels++;
+                }
+            }
+        }
+        double compactMilliseconds = clock.Elapsed.TotalMilliseconds / Math.Max(1, passes);
+        
+        if (legacySum != compactSum || legacyLabels != compactLabels)
+        {
+            throw new InvalidOperationException("Result walks disagree");
+        }
+        
+        GC.KeepAlive(legacy);
+        GC.KeepAlive(compact);
+        return new ResultMemoryBenchmarkReport
+        {
+            Results = results,
+            DetectionsPerResult = detections,
+            LegacyBytesPerEntry = results > 0 ? (double)legacyBytes / results : 0,
+            CompactBytesPerEntry = results > 0 ? (double)compactBytes / results : 0,
+            CompactEstimatedBytes = results > 0 ? compact[0].EstimatedBytes : 0,
+            LegacyIterationMilliseconds = legacyMilliseconds,
+            CompactIterationMilliseconds = compactMilliseconds
+        };
+    }
+
+    // Replays a month of synthetic cache misses against the budget scheduler
+    // on a simulated clock, with no backend or camera. Usage is front-loaded
+    // (the first day is three times as busy as the last) and a fifth of the
+    // misses are novel views; the rest are low-novelty repeats. The report
+    // also shows how the old first-come hard limit would have fared.
+    public static BudgetSimulationReport SimulateBudgetMonth(
+        int seed = 1, int missesPerDay = 400, int callsPerMinute = 20,
+        float lowNoveltyReserve = 0.8f, float deferNovelty = 0.5f, float maxDeferSeconds = 5f)
+    {
+        var random = new System.Random(seed);
+        var monthStart = new DateTime(2024, 1, 1);
+        DateTime now = monthStart;
+        var scheduler = new BudgetScheduler(FREE_TIER_LIMIT, callsPerMinute, lowNoveltyReserve, null, () => now);
+        var report = new BudgetSimulationReport { MonthlyLimit = FREE_TIER_LIMIT };
+        int hardLimitUsed = 0;
+        
+        int days = DateTime.DaysInMonth(monthStart.Year, monthStart.Month);
+        for (int day = 0; day < days; day++)
+        {
+            int misses = (int)(missesPerDay * (1.5 - (double)day / (days - 1)));
+            var arrivals = new double[misses];
+            for (int i = 0; i < misses; i++)
+            {
+                // Waking hours only, 08:00 to 20:00.
+                arrivals[i] = (8 + 12 * random.NextDouble()) * 3600;
+            }
+            Array.Sort(arrivals);
+            
+            foreach (double seconds in arrivals)
+            {
+                DateTime arrival = monthStart.AddDays(day).AddSeconds(seconds);
+                if (arrival > now) now = arrival;
+                
+                bool novel = random.NextDouble() < 0.2;
+                float novelty = novel ? 0.5f + 0.5f * (float)random.NextDouble() : 0.3f * (float)random.NextDouble();
+                if (novel) report.NovelMisses++; else report.RepeatMisses++;
+                
+                if (hardLimitUsed < FREE_TIER_LIMIT)
+                {
+                    hardLimitUsed++;
+                    if (novel) report.HardLimitNovelServed++;
+                    if (hardLimitUsed == FREE_TIER_LIMIT) report.HardLimitExhaustedDay = day + 1;
+                }
+                
+                while (true)
+                {
+                    var decision = scheduler.TryAcquire(novelty, out TimeSpan wait);
+                    if (decision == BudgetDecision.Granted)
+                    {
+                        if (novel) report.NovelServed++; else report.RepeatServed++;
+                        break;
+                    }
+                    if (decision == BudgetDecision.Denied || novelty < deferNovelty || wait.TotalSeconds > maxDeferSeconds)
+                    {
+                        break;
+                    }
+                    report.Deferred++;
+                    now += wait;
+                }
+            }
+        }
+        
+        report.Used = scheduler.UsedThisMonth;
+        return report;
+    }
+    
+    private void CleanExpiredCache()
+    {
+        resultCache.RemoveExpired(DateTime.Now.AddHours(-CACHE_EXPIRATION_HOURS));
+    }
+    
+    // Called for every entry the cache drops. Evicted entries stay reachable
+    // through the persistent store, so their perceptual hashes are kept.
+    private void OnCacheEntryRemoved(CacheKey key, bool expired)
+    {
+        if (!expired && persistentStore != null)
+        {
+            return;
+        }
+        
+        if (key.TryGetPerceptualHash(out ulong perceptualHash))
+        {
+            perceptualIndex.Remove(perceptualHash);
+        }
+    }
+    
+    private bool TryGetCachedResult(CacheKey key, out DetectionResult result)
+    {
+        if (resultCache.TryGetValue(key, out result))
+        {
+            return true;
+        }
+        
+        if (persistentStore != null &&
+            persistentStore.TryRead(key, DateTime.Now.AddHours(-CACHE_EXPIRATION_HOURS), out result))
+        {
+            PersistentCacheHits++;
+            resultCache.Set(key, result);
+            return true;
+        }
+        
+        // Neither tier holds the key any more, so stop matching against it.
+        OnCacheEntryRemoved(key, expired: true);
+        return false;
+    }
+    
+    private async Task EnsurePersistentCacheLoaded()
+    {
+        if (persistentStore == null || persistentKeysIndexed)
+        {
+            return;
+        }
+        
+        try
+        {
+            var keys = await persistentStore.LoadTask;
+            foreach (var key in keys)
+            {
+                if (key.TryGetPerceptualHash(out ulong perceptualHash))
+                {
+                    perceptualIndex.Add(perceptualHash);
+                }
+            }
+        }
+        catch (Exception ex)
+        {
+            Debug.LogWarning($"Persistent cache unavailable: {ex.Message}");
+            persistentStore.Dispose();
+            persistentStore = null;
+        }
+        
+        persistentKeysIndexed = true;
+    }
+    
+    // Where the pixel (pixelX, pixelY) of a width x height frame taken at pose
+    // lies in the room: the first mesh surface along the camera ray within
+    // maxDistance metres, or fallbackDistance metres along the ray when there
+    // is no mesh or the ray misses it.
+    public static Vector3 ProjectToWorld(
+        CameraPose pose, float pixelX, float pixelY, int width, int height,
+        SpatialMeshIndex mesh, float maxDistance, float fallbackDistance, out bool onMesh)
+    {
+        // Image rows run downwards; clip space y runs up. Undoing the
+        // projection for a clip-space depth of 1 gives a point in front of
+        // the camera, which looks down -z.
+        var projection = pose.Projection;
+        float clipX = 2f * pixelX / width - 1f;
+        float clipY = 1f - 2f * pixelY / height;
+        float z = 1f / projection.m22;
+        var cameraRay = new Vector3(
+            (clipX - z * projection.m02) / projection.m00,
+            (clipY - z * projection.m12) / projection.m11,
+            z);
+
+        var direction = pose.CameraToWorld.MultiplyVector(cameraRay);
+        float length = (float)Math.Sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+        direction = new Vector3(direction.x / length, direction.y / length, direction.z / length);
+        var origin = pose.CameraToWorld.MultiplyPoint3x4(Vector3.zero);
+
+        float distance = fallbackDistance;
+        onMesh = mesh != null && mesh.Raycast(origin, direction, maxDistance, out distance);
+        if (!onMesh)
+        {
+            distance = fallbackDistance;
+        }
+        return new Vector3(
+            origin.x + direction.x * distance,
+            origin.y + direction.y * distance,
+            origin.z + direction.z * distance);
+    }
+    
+    // Everything the local model reports, or null if it is unavailable or
+    // found nothing. The caller decides whether it is confident enough.
+    private async Task<DetectionResult> TryLocalProcessing(FrameBuffer frame, Resolution resolution, CancellationToken cancellationToken)
+    {
+        if (!useLocalDetector || localDetectorLoad == null || !localDetectorLoad.IsCompleted)
+        {
+            return null;
+        }
+        
+        if (localDetectorLoad.IsFaulted)
+        {
+            Debug.LogWarning($"Local detector unavailable: {localDetectorLoad.Exception?.GetBaseException().Message}");
+            localDetectorLoad = null;
+            return null;
+        }
+        
+        var detector = localDetectorLoad.Result;
+        var detections = await RunOnWorker(() => detector.Detect(frame.Span, resolution.width, resolution.height), cancellationToken);
+        return detections.Count > 0 ? new DetectionResult(detections) : null;
+    }
+
+    // dHash over a 9x8 luma grid. Each cell averages a sparse sample of the
+    // BGRA32 frame, so the cost is independent of the capture resolution.
+    private static bool TryCalculatePerceptualHash(ReadOnlySpan<byte> imageBytes, int width, int height, out ulong hash)
+    {
+        hash = 0;
+        const int gridWidth = 9;
+        const int gridHeight = 8;
+        
+        Span<byte> cellLuma = stackalloc byte[gridWidth * gridHeight];
+        if (!TrySampleLumaGrid(imageBytes, width, height, gridWidth, gridHeight, 16, cellLuma))
+        {
+            return false;
+        }
+        
+        for (int row = 0; row < gridHeight; row++)
+        {
+            for (int col = 0; col < gridWidth - 1; col++)
+            {
+                int cell = row * gridWidth + col;
+                if (cellLuma[cell] > cellLuma[cell + 1])
+                {
+                    hash |= 1UL << (row * (gridWidth - 1) + col);
+                }
+            }
+        }
+        return true;
+    }
+    
+    // One key per tile of a columns x rows grid, from a dHash of the tile's own
+    // 9x8 block of a single luma sampling pass. The tile index is part of the
+    // key, so the same texture in another part of the view is not reused.
+    private static bool TryCalculateTileKeys(ReadOnlySpan<byte> imageBytes, int width, int height,
+        int columns, int rows, out CacheKey[] keys)
+    {
+        keys = null;
+        const int cellsPerTileX = 9;
+        const int cellsPerTileY = 8;
+        int gridWidth = columns * cellsPerTileX;
+        int gridHeight = rows * cellsPerTileY;
+        
+        Span<byte> cellLuma = stackalloc byte[gridWidth * gridHeight];
+        if (!TrySampleLumaGrid(imageBytes, width, height, gridWidth, gridHeight, 4, cellLuma))
+        {
+            return false;
+        }
+        
+        keys = new CacheKey[columns * rows];
+        for (int tile = 0; tile < keys.Length; tile++)
+        {
+            int originX = (tile % columns) * cellsPerTileX;
+            int originY = (tile / columns) * cellsPerTileY;
+            ulong hash = 0;
+            for (int row = 0; row < cellsPerTileY; row++)
+            {
+                int cell = (originY + row) * gridWidth + originX;
+                for (int col = 0; col < cellsPerTileX - 1; col++, cell++)
+                {
+                    if (cellLuma[cell] > cellLuma[cell + 1])
+                    {
+                        hash |= 1UL << (row * (cellsPerTileX - 1) + col);
+                    }
+                }
+            }
+            keys[tile] = CacheKey.FromTileHash(tile, hash);
+        }
+        return true;
+    }
+    
+    // Mean luma of each cell in a gridWidth x gridHeight grid, estimated from
+    // roughly samplesPerCellEdge^2 evenly spaced pixels per cell.
+    private static bool TrySampleLumaGrid(
+        ReadOnlySpan<byte> imageBytes, int width, int height,
+        int gridWidth, int gridHeight, int samplesPerCellEdge, Span<byte> cells)
+    {
+        if (width < gridWidth || height < gridHeight || imageBytes.Length != width * height * 4)
+        {
+            return false;
+        }
+        
+        ReadOnlySpan<uint> pixels = MemoryMarshal.Cast<byte, uint>(imageBytes);
+        Span<uint> sums = stackalloc uint[gridWidth * gridHeight];
+        Span<ushort> counts = stackalloc ushort[gridWidth * gridHeight];
+        
+        int rowStep = Math.Max(1, height / (gridHeight * samplesPerCellEdge));
+        int colStep = Math.Max(1, width / (gridWidth * samplesPerCellEdge));
+        
+        for (int y = 0; y < height; y += rowStep)
+        {
+            int rowOffset = y * width;
+            int cellRow = y * gridHeight / height * gridWidth;
+            for (int x = 0; x < width; x += colStep)
+            {
+                // BGRA32 read as a little-endian uint: 0xAARRGGBB
+                uint pixel = pixels[rowOffset + x];
+                uint luma = (((pixel >> 16) & 0xFF) * 77 + ((pixel >> 8) & 0xFF) * 150 + (pixel & 0xFF) * 29) >> 8;
+                int cell = cellRow + x * gridWidth / width;
+                sums[cell] += luma;
+                counts[cell]++;
+            }
+        }
+        
+        for (int i = 0; i < cells.Length; i++)
+        {
+            cells[i] = (byte)(counts[i] > 0 ? sums[i] / counts[i] : 0);
+        }
+        return true;
+    }
+    
+    // Area-average downscale of a BGRA32 image. Channels are accumulated two
+    // at a time in 32-bit lanes of a ulong (B+R and G+A), halving the adds
+    // per source pixel without needing hardware intrinsics.
+    // destinationStride and destinationOffset (in pixels) allow writing into a
+    // sub-rectangle of a larger image, e.g. one mosaic tile.
+    private static void DownscaleBgra32(
+        ReadOnlySpan<byte> source, int width, int height,
+        byte[] destination, int targetWidth, int targetHeight,
+        int destinationStride = 0, int destinationOffset = 0)
+    {
+        DownscaleBgra32Region(source, width, 0, 0, width, height,
+            destination, targetWidth, targetHeight, destinationStride, destinationOffset);
+    }
+    
+    // As DownscaleBgra32, reading only the regionWidth x regionHeight block at
+    // (regionX, regionY) of a source image sourceStride pixels wide.
+    private static void DownscaleBgra32Region(
+        ReadOnlySpan<byte> source, int sourceStride, int regionX, int regionY, int regionWidth, int regionHeight,
+        byte[] destination, int targetWidth, int targetHeight,
+        int destinationStride = 0, int destinationOffset = 0)
+    {
+        if (destinationStride <= 0)
+        {
+            destinationStride = targetWidth;
+        }
+        
+        ReadOnlySpan<uint> sourcePixels = MemoryMarshal.Cast<byte, uint>(source);
+        Span<uint> targetPixels = MemoryMarshal.Cast<byte, uint>(new Span<byte>(destination));
+        
+        var columnStart = new int[targetWidth + 1];
+        for (int x = 0; x <= targetWidth; x++)
+        {
+            columnStart[x] = regionX + (int)((long)x * regionWidth / targetWidth);
+        }
+        
+        for (int y = 0; y < targetHeight; y++)
+        {
+            int rowStart = regionY + (int)((long)y * regionHeight / targetHeight);
+            int rowEnd = Math.Max(rowStart + 1, regionY + (int)((long)(y + 1) * regionHeight / targetHeight));
+            
+            for (int x = 0; x < targetWidth; x++)
+            {
+                int colStart = columnStart[x];
+                int colEnd = Math.Max(colStart + 1, columnStart[x + 1]);
+                ulong blueRed = 0;
+                ulong greenAlpha = 0;
+                
+                for (int sy = rowStart; sy < rowEnd; sy++)
+                {
+                    int offset = sy * sourceStride;
+                    for (int sx = colStart; sx < colEnd; sx++)
+                    {
+                        uint pixel = sourcePixels[offset + sx];
+                        blueRed += (pixel & 0xFFu) | ((ulong)(pixel & 0xFF0000u) << 16);
+                        greenAlpha += ((pixel >> 8) & 0xFFu) | ((ulong)(pixel & 0xFF000000u) << 8);
+                    }
+                }
+                
+                uint count = (uint)((rowEnd - rowStart) * (colEnd - colStart));
+                uint blue = (uint)(blueRed & 0xFFFFFFFF) / count;
+                uint red = (uint)(blueRed >> 32) / count;
+                uint green = (uint)(greenAlpha & 0xFFFFFFFF) / count;
+                uint alpha = (uint)(greenAlpha >> 32) / count;
+                targetPixels[destinationOffset + y * destinationStride + x] = blue | (green << 8) | (red << 16) | (alpha << 24);
+            }
+        }
+    }
+    
+    // A rectangle of a captured frame and the place it is packed into a mosaic.
+    private struct MosaicTile
+    {
+        public int SourceX;
+        public int SourceY;
+        public int SourceWidth;
+        public int SourceHeight;
+        public int PackedX;
+        public int PackedY;
+        public int PackedWidth;
+        public int PackedHeight;
+    }
+    
+    // Lays out count tiles of one size on a near-square grid. Callers fill in
+    // the source rectangles.
+    private static MosaicTile[] LayoutMosaic(int count, int tileWidth, int tileHeight, out int mosaicWidth, out int mosaicHeight)
+    {
+        int columns = (int)Math.Ceiling(Math.Sqrt(count));
+        int rows = (count + columns - 1) / columns;
+        mosaicWidth = tileWidth * columns;
+        mosaicHeight = tileHeight * rows;
+        
+        var tiles = new MosaicTile[count];
+        for (int i = 0; i < count; i++)
+        {
+            tiles[i].PackedX = (i % columns) * tileWidth;
+            tiles[i].PackedY = (i / columns) * tileHeight;
+            tiles[i].PackedWidth = tileWidth;
+            tiles[i].PackedHeight = tileHeight;
+        }
+        return tiles;
+    }
+    
+    // Assigns each object to the tile holding its centre and maps its
+    // rectangle back into that tile's source coordinates. Objects straddling
+    // tiles are kept whole with the tile that owns their centre.
+    private static List<DetectedObject>[] SplitMosaicObjects(IList<DetectedObject> objects, MosaicTile[] tiles)
+    {
+        var perTile = new List<DetectedObject>[tiles.Length];
+        for (int i = 0; i < tiles.Length; i++)
+        {
+            perTile[i] = new List<DetectedObject>();
+        }
+        
+        if (objects == null)
+        {
+            return perTile;
+        }
+        
+        foreach (var obj in objects)
+        {
+            int centerX = obj.Rectangle.X + obj.Rectangle.W / 2;
+            int centerY = obj.Rectangle.Y + obj.Rectangle.H / 2;
+            for (int i = 0; i < tiles.Length; i++)
+            {
+                var tile = tiles[i];
+                if (centerX < tile.PackedX || centerX >= tile.PackedX + tile.PackedWidth ||
+                    centerY < tile.PackedY || centerY >= tile.PackedY + tile.PackedHeight)
+                {
+                    continue;
+                }
+                
+                float scaleX = (float)tile.SourceWidth / tile.PackedWidth;
+                float scaleY = (float)tile.SourceHeight / tile.PackedHeight;
+                perTile[i].Add(new DetectedObject
+                {
+                    ObjectProperty = obj.ObjectProperty,
+                    Confidence = obj.Confidence,
+                    Parent = obj.Parent,
+                    Rectangle = new BoundingRect
+                    {
+                        X = tile.SourceX + (int)((obj.Rectangle.X - tile.PackedX) * scaleX),
+                        Y = tile.SourceY + (int)((obj.Rectangle.Y - tile.PackedY) * scaleY),
+                        W = (int)(obj.Rectangle.W * scaleX),
+                        H = (int)(obj.Rectangle.H * scaleY)
+                    }
+                });
+                break;
+            }
+        }
+        return perTile;
+    }
+    
+    // NV12 (a full-resolution Y plane, then half-resolution interleaved U/V)
+    // to BGRA32, BT.601 limited range in fixed point. Width and height must
+    // be even, as camera formats are.
+    private static void ConvertNv12ToBgra32(ReadOnlySpan<byte> nv12, int width, int height, Span<byte> bgra)
+    {
+        Span<uint> pixels = MemoryMarshal.Cast<byte, uint>(bgra);
+        int chromaPlane = width * height;
+        for (int y = 0; y < height; y++)
+        {
+            int row = y * width;
+            int chromaRow = chromaPlane + (y >> 1) * width;
+            for (int x = 0; x < width; x += 2)
+            {
+                int u = nv12[chromaRow + x] - 128;
+                int v = nv12[chromaRow + x + 1] - 128;
+                int red = 409 * v + 128;
+                int green = -100 * u - 208 * v + 128;
+                int blue = 516 * u + 128;
+                for (int i = 0; i < 2; i++)
+                {
+                    int luma = (nv12[row + x + i] - 16) * 298;
+                    // Written as a little-endian uint: 0xAARRGGBB
+                    pixels[row + x + i] = 0xFF000000u |
+                        (uint)ClampByte((luma + red) >> 8) << 16 |
+                        (uint)ClampByte((luma + green) >> 8) << 8 |
+                        (uint)ClampByte((luma + blue) >> 8);
+                }
+            }
+        }
+    }
+    
+    // The inverse, averaging chroma over each 2x2 block.
+    private static void ConvertBgra32ToNv12(ReadOnlySpan<byte> bgra, int width, int height, Span<byte> nv12)
+    {
+        ReadOnlySpan<uint> pixels = MemoryMarshal.Cast<byte, uint>(bgra);
+        int chromaPlane = width * height;
+        for (int y = 0; y < height; y += 2)
+        {
+            for (int x = 0; x < width; x += 2)
+            {
+                int u = 0, v = 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    int index = (y + (i >> 1)) * width + x + (i & 1);
+                    uint pixel = pixels[index];
+                    int red = (int)((pixel >> 16) & 0xFF), green = (int)((pixel >> 8) & 0xFF), blue = (int)(pixel & 0xFF);
+                    nv12[index] = (byte)(((66 * red + 129 * green + 25 * blue + 128) >> 8) + 16);
+                    u += ((-38 * red - 74 * green + 112 * blue + 128) >> 8) + 128;
+                    v += ((112 * red - 94 * green - 18 * blue + 128) >> 8) + 128;
+                }
+                int chroma = chromaPlane + (y >> 1) * width + x;
+                nv12[chroma] = (byte)((u + 2) >> 2);
+                nv12[chroma + 1] = (byte)((v + 2) >> 2);
+            }
+        }
+    }
+    
+    private static int ClampByte(int value)
+    {
+        return value < 0 ? 0 : value > 255 ? 255 : value;
+    }
+    
+    private static byte[] EncodeBgra32(byte[] pixels, int width, int height, UploadEncoding encoding, int quality)
+    {
+        return encoding == UploadEncoding.Png
+            ? ImageConversion.EncodeArrayToPNG(pixels, GraphicsFormat.B8G8R8A8_UNorm, (uint)width, (uint)height, (uint)width * 4)
+            : ImageConversion.EncodeArrayToJPG(pixels, GraphicsFormat.B8G8R8A8_UNorm, (uint)width, (uint)height, (uint)width * 4, quality);
+    }
+    
+    // Detections and tags stored as a struct of arrays in one allocation:
+    // float32 confidences (detections, then tags), interned label IDs
+    // (detections, then tags), then packed rectangles (x, y, w, h as ushort,
+    // in capture coordinates). A cached entry is two objects regardless of
+    // how many detections it holds, and walking it touches contiguous memory
+    // only. Parent objects ("dog" for "Labrador") live in the shared label
+    // table rather than in each result.
+    private sealed class DetectionResult
+    {
+        private const int BYTES_PER_DETECTION = 4 + 2 + 8;
+        private const int BYTES_PER_TAG = 4 + 2;
+        
+        private readonly byte[] data;
+        
+        public int Count { get; }
+        public int TagCount { get; }
+        public DateTime Timestamp { get; }
+        
+        public ReadOnlySpan<float> Confidences => Section<float>(0, Count * 4);
+        public ReadOnlySpan<float> TagConfidences => Section<float>(Count * 4, TagCount * 4);
+        public ReadOnlySpan<ushort> LabelIds => Section<ushort>((Count + TagCount) * 4, Count * 2);
+        public ReadOnlySpan<ushort> TagIds => Section<ushort>((Count + TagCount) * 4 + Count * 2, TagCount * 2);
+        public ReadOnlySpan<ushort> Rectangles => Section<ushort>((Count + TagCount) * 6, Count * 8);
+        
+        // Rough managed footprint, used for the cache byte budget.
+        public long EstimatedBytes => 48 + 24 + data.Length;
+        
+        public float MeanConfidence
+        {
+            get
+            {
+                float sum = 0;
+                foreach (float confidence in Confidences)
+                {
+                    sum += confidence;
+                }
+                return Count > 0 ? sum / Count : 0;
+            }
+        }
+        
+        public float MinimumConfidence
+        {
+            get
+            {
+                float minimum = 1f;
+                foreach (float confidence in Confidences)
+                {
+                    minimum = Math.Min(minimum, confidence);
+                }
+                return minimum;
+            }
+        }
+        
+        private DetectionResult(int count, int tagCount, DateTime timestamp)
+        {
+            Count = count;
+            TagCount = tagCount;
+            Timestamp = timestamp;
+            data = new byte[count * BYTES_PER_DETECTION + tagCount * BYTES_PER_TAG];
+        }
+        
+        // coordinateScale is the ratio of the analyzed image to the captured
+        // frame; rectangles are mapped back to capture coordinates.
+        public DetectionResult(ImageAnalysis analysis, float coordinateScale = 1f)
+            : this(analysis.Objects, analysis.Tags, coordinateScale)
+        {
+        }
+        
+        public DetectionResult(IList<DetectedObject> objects, IList<ImageTag> tags = null, float coordinateScale = 1f)
+            : this(objects?.Count ?? 0, tags?.Count ?? 0, DateTime.Now)
+        {
+            for (int i = 0; i < Count; i++)
+            {
+                var obj = objects[i];
+                ushort label = DetectionLabels.Intern(obj.ObjectProperty);
+                for (var parent = obj.Parent; parent != null; parent = parent.Parent)
+                {
+                    ushort parentLabel = DetectionLabels.Intern(parent.ObjectProperty);
+                    DetectionLabels.SetParent(label, parentLabel);
+                    label = parentLabel;
+                }
+                
+                SetDetection(i, DetectionLabels.Intern(obj.ObjectProperty), (float)obj.Confidence,
+                    obj.Rectangle.X / coordinateScale, obj.Rectangle.Y / coordinateScale,
+                    obj.Rectangle.W / coordinateScale, obj.Rectangle.H / coordinateScale);
+            }
+            
+            for (int i = 0; i < TagCount; i++)
+            {
+                SetTag(i, DetectionLabels.Intern(tags[i].Name), (float)tags[i].Confidence);
+            }
+        }
+        
+        public string GetLabel(int index)
+        {
+            return DetectionLabels.Get(LabelIds[index]);
+        }
+        
+        public string GetTag(int index)
+        {
+            return DetectionLabels.Get(TagIds[index]);
+        }
+        
+        // Parent of the index-th detection's object, or null at the top of the hierarchy.
+        public string GetParentLabel(int index)
+        {
+            ushort parent = DetectionLabels.GetParent(LabelIds[index]);
+            return parent != 0 ? DetectionLabels.Get(parent) : null;
+        }
+        
+        // A result with no detections stamped at `timestamp`, for exercising
+        // expiry without waiting on the clock.
+        public static DetectionResult Empty(DateTime timestamp)
+        {
+            return new DetectionResult(0, 0, timestamp);
+        }
+        
+        public static DetectionResult Concat(IReadOnlyList<DetectionResult> parts)
+        {
+            int count = 0;
+            int tagCount = 0;
+            foreach (var part in parts)
+            {
+                count += part.Count;
+                tagCount += part.TagCount;
+            }
+            
+            var result = new DetectionResult(count, tagCount, DateTime.Now);
+            int offset = 0;
+            int tagOffset = 0;
+            foreach (var part in parts)
+            {
+                part.Confidences.CopyTo(result.WritableSection<float>(offset * 4, part.Count * 4));
+                part.TagConfidences.CopyTo(result.WritableSection<float>((count + tagOffset) * 4, part.TagCount * 4));
+                part.LabelIds.CopyTo(result.WritableSection<ushort>((count + tagCount) * 4 + offset * 2, part.Count * 2));
+                part.TagIds.CopyTo(result.WritableSection<ushort>((count + tagCount) * 4 + (count + tagOffset) * 2, part.TagCount * 2));
+                part.Rectangles.CopyTo(result.WritableSection<ushort>((count + tagCount) * 6 + offset * 8, part.Count * 8));
+                offset += part.Count;
+                tagOffset += part.TagCount;
+            }
+            return result;
+        }
+        
+        // Copy with each detection's box moved to a new top-left corner
+        // (x, y pairs in capture coordinates); everything else is kept.
+        public DetectionResult WithPositions(ReadOnlySpan<float> corners)
+        {
+            var result = new DetectionResult(Count, TagCount, DateTime.Now);
+            Buffer.BlockCopy(data, 0, result.data, 0, data.Length);
+            var rectangles = result.WritableSection<ushort>((Count + TagCount) * 6, Count * 8);
+            for (int i = 0; i < Count; i++)
+            {
+                rectangles[i * 4] = ClampCoordinate(corners[i * 2]);
+                rectangles[i * 4 + 1] = ClampCoordinate(corners[i * 2 + 1]);
+            }
+            return result;
+        }
+        
+        // Labels are written as strings, each detection followed by its
+        // ancestors; IDs are only meaningful within one process.
+        public void Write(BinaryWriter writer)
+        {
+            writer.Write(Timestamp.Ticks);
+            writer.Write(Count);
+            writer.Write(TagCount);
+            var confidences = Confidences;
+            var labels = LabelIds;
+            var rectangles = Rectangles;
+            for (int i = 0; i < Count; i++)
+            {
+                writer.Write(confidences[i]);
+                for (int j = 0; j < 4; j++)
+                {
+                    writer.Write(rectangles[i * 4 + j]);
+                }
+                
+                var ancestors = new List<ushort>();
+                for (ushort id = labels[i]; id != 0 && ancestors.Count < byte.MaxValue; id = DetectionLabels.GetParent(id))
+                {
+                    ancestors.Add(id);
+                }
+                writer.Write((byte)ancestors.Count);
+                foreach (ushort id in ancestors)
+                {
+                    writer.Write(DetectionLabels.Get(id));
+                }
+            }
+            
+            var tagConfidences = TagConfidences;
+            for (int i = 0; i < TagCount; i++)
+            {
+                writer.Write(GetTag(i));
+                writer.Write(tagConfidences[i]);
+            }
+        }
+        
+        public static DetectionResult Read(BinaryReader reader)
+        {
+            var timestamp = new DateTime(reader.ReadInt64());
+            int count = reader.ReadInt32();
+            int tagCount = reader.ReadInt32();
+            long available = reader.BaseStream.Length;
+            if (count < 0 || tagCount < 0 || count > available / BYTES_PER_DETECTION || tagCount > available / BYTES_PER_TAG)
+            {
+                throw new InvalidDataException("Detection count out of range");
+            }
+            
+            var result = new DetectionResult(count, tagCount, timestamp);
+            for (int i = 0; i < count; i++)
+            {
+                float confidence = reader.ReadSingle();
+                ushort x = reader.ReadUInt16();
+                ushort y = reader.ReadUInt16();
+                ushort width = reader.ReadUInt16();
+                ushort height = reader.ReadUInt16();
+                
+                ushort label = 0;
+                ushort child = 0;
+                int depth = reader.ReadByte();
+                for (int level = 0; level < depth; level++)
+                {
+                    ushort id = DetectionLabels.Intern(reader.ReadString());
+                    if (level == 0)
+                    {
+                        label = id;
+                    }
+                    else
+                    {
+                        DetectionLabels.SetParent(child, id);
+                    }
+                    child = id;
+                }
+                result.SetDetection(i, label, confidence, x, y, width, height);
+            }
+            
+            for (int i = 0; i < tagCount; i++)
+            {
+                ushort tag = DetectionLabels.Intern(reader.ReadString());
+                result.SetTag(i, tag, reader.ReadSingle());
+            }
+            return result;
+        }
+        
+        private ReadOnlySpan<T> Section<T>(int offset, int length) where T : struct
+        {
+            return MemoryMarshal.Cast<byte, T>(new ReadOnlySpan<byte>(data, offset, length));
+        }
+        
+        private Span<T> WritableSection<T>(int offset, int length) where T : struct
+        {
+            return MemoryMarshal.Cast<byte, T>(new Span<byte>(data, offset, length));
+        }
+        
+        private void SetDetection(int index, ushort label, float confidence, float x, float y, float width, float height)
+        {
+            WritableSection<float>(0, Count * 4)[index] = confidence;
+            WritableSection<ushort>((Count + TagCount) * 4, Count * 2)[index] = label;
+            var rectangles = WritableSection<ushort>((Count + TagCount) * 6, Count * 8);
+            rectangles[index * 4] = ClampCoordinate(x);
+            rectangles[index * 4 + 1] = ClampCoordinate(y);
+            rectangles[index * 4 + 2] = ClampCoordinate(width);
+            rectangles[index * 4 + 3] = ClampCoordinate(height);
+        }
+        
+        private void SetTag(int index, ushort tag, float confidence)
+        {
+            WritableSection<float>(Count * 4, TagCount * 4)[index] = confidence;
+            WritableSection<ushort>((Count + TagCount) * 4 + Count * 2, TagCount * 2)[index] = tag;
+        }
+        
+        private static ushort ClampCoordinate(float value)
+        {
+            return (ushort)Math.Max(0f, Math.Min(ushort.MaxValue, value));
+        }
+    }
+    
+    // Process-wide label table shared by every DetectionResult, with each
+    // label's parent object (0 for none). Interning takes a lock; lookups
+    // read published arrays without one.
+    private static class DetectionLabels
+    {
+        private static readonly Dictionary<string, ushort> ids = new Dictionary<string, ushort>(StringComparer.Ordinal) { [string.Empty] = 0 };
+        private static volatile string[] names = { string.Empty, null, null, null };
+        private static volatile ushort[] parents = new ushort[4];
+        
+        // Past 65535 distinct labels, new ones map to the empty label.
+        public static ushort Intern(string name)
+        {
+            name = name ?? string.Empty;
+            lock (ids)
+            {
+                if (ids.TryGetValue(name, out ushort id))
+                {
+                    return id;
+                }
+                
+                if (ids.Count > ushort.MaxValue)
+                {
+                    return 0;
+                }
+                
+                id = (ushort)ids.Count;
+                var table = names;
+                if (id >= table.Length)
+                {
+                    int size = Math.Min(table.Length * 2, ushort.MaxValue + 1);
+                    var parentTable = parents;
+                    Array.Resize(ref parentTable, size);
+                    parents = parentTable;
+                    Array.Resize(ref table, size);
+                }
+                table[id] = name;
+                names = table;
+                ids.Add(name, id);
+                return id;
+            }
+        }
+        
+        public static string Get(ushort id)
+        {
+            return names[id];
+        }
+        
+        public static ushort GetParent(ushort id)
+        {
+            return parents[id];
+        }
+        
+        // The service's taxonomy is fixed, so the latest answer simply wins.
+        public static void SetParent(ushort id, ushort parent)
+        {
+            if (id == 0 || id == parent)
+            {
+                return;
+            }
+            
+            lock (ids)
+            {
+                parents[id] = parent;
+            }
+        }
+    }
+    
+    // Bounding volume hierarchy over a world-space triangle mesh for
+    // nearest-hit raycasts. Nodes and triangles live in flat arrays in
+    // depth-first order (a node's left child directly follows it), so a
+    // query walks contiguous memory and allocates nothing. The index is
+    // immutable once built and may be queried from any thread.
+    public sealed class SpatialMeshIndex
+    {
+        private const int MAX_LEAF_TRIANGLES = 4;
+        private const int MAX_DEPTH = 48;
+        
+        // Per node: min x, y, z, then max x, y, z.
+        private readonly float[] bounds;
+        // Leaves: first triangle and triangle count. Inner nodes: right child and 0.
+        private readonly int[] first;
+        private readonly int[] count;
+        // Per triangle, in leaf order: first vertex, then both edges from it.
+        private readonly float[] triangles;
+        private int nodeCount;
+        
+        public int TriangleCount => triangles.Length / 9;
+        public int NodeCount => nodeCount;
+        
+        private SpatialMeshIndex(int triangleCount)
+        {
+            int maxNodes = Math.Max(1, 2 * triangleCount);
+            bounds = new float[maxNodes * 6];
+            first = new int[maxNodes];
+            count = new int[maxNodes];
+            triangles = new float[triangleCount * 9];
+        }
+        
+        // indices holds three vertex indices per triangle.
+        public static SpatialMeshIndex Build(IReadOnlyList<Vector3> vertices, IReadOnlyList<int> indices)
+        {
+            int triangleCount = indices.Count / 3;
+            var corners = new float[triangleCount * 9];
+            var centroids = new float[triangleCount * 3];
+            var order = new int[triangleCount];
+            for (int t = 0; t < triangleCount; t++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    var vertex = vertices[indices[t * 3 + c]];
+                    corners[t * 9 + c * 3] = vertex.x;
+                    corners[t * 9 + c * 3 + 1] = vertex.y;
+                    corners[t * 9 + c * 3 + 2] = vertex.z;
+                }
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    centroids[t * 3 + axis] = (corners[t * 9 + axis] + corners[t * 9 + 3 + axis] + corners[t * 9 + 6 + axis]) / 3f;
+                }
+                order[t] = t;
+            }
+            
+            var index = new SpatialMeshIndex(triangleCount);
+            if (triangleCount > 0)
+            {
+                index.Split(corners, centroids, order, new float[triangleCount], 0, triangleCount, 0);
+            }
+            
+            for (int i = 0; i < triangleCount; i++)
+            {
+                int source = order[i] * 9;
+                int target = i * 9;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    float origin = corners[source + axis];
+                    index.triangles[target + axis] = origin;
+                    index.triangles[target + 3 + axis] = corners[source + 3 + axis] - origin;
+                    index.triangles[target + 6 + axis] = corners[source + 6 + axis] - origin;
+                }
+            }
+            return index;
+        }
+        
+        // Median split along the longest axis of the triangle centroids.
+        // Halving keeps the depth at log2 of the triangle count, which bounds
+        // the traversal stack.
+        private int Split(float[] corners, float[] centroids, int[] order, float[] keys, int start, int length, int depth)
+        {
+            int node = nodeCount++;
+            var centroidMin = new Vector3(float.MaxValue, float.MaxValue, float.MaxValue);
+            var centroidMax = new Vector3(float.MinValue, float.MinValue, float.MinValue);
+            int b = node * 6;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                bounds[b + axis] = float.MaxValue;
+                bounds[b + 3 + axis] = float.MinValue;
+            }
+            
+            for (int i = start; i < start + length; i++)
+            {
+                int t = order[i];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    for (int c = 0; c < 3; c++)
+                    {
+                        float value = corners[t * 9 + c * 3 + axis];
+                        bounds[b + axis] = Math.Min(bounds[b + axis], value);
+                        bounds[b + 3 + axis] = Math.Max(bounds[b + 3 + axis], value);
+                    }
+                }
+                centroidMin = new Vector3(
+                    Math.Min(centroidMin.x, centroids[t * 3]),
+                    Math.Min(centroidMin.y, centroids[t * 3 + 1]),
+                    Math.Min(centroidMin.z, centroids[t * 3 + 2]));
+                centroidMax = new Vector3(
+                    Math.Max(centroidMax.x, centroids[t * 3]),
+                    Math.Max(centroidMax.y, centroids[t * 3 + 1]),
+                    Math.Max(centroidMax.z, centroids[t * 3 + 2]));
+            }
+            
+            float extentX = centroidMax.x - centroidMin.x;
+            float extentY = centroidMax.y - centroidMin.y;
+            float extentZ = centroidMax.z - centroidMin.z;
+            int split = extentX >= extentY && extentX >= extentZ ? 0 : extentY >= extentZ ? 1 : 2;
+            float extent = split == 0 ? extentX : split == 1 ? extentY : extentZ;
+            
+            // Coincident centroids cannot be separated; they share one leaf.
+            if (length <= MAX_LEAF_TRIANGLES || depth >= MAX_DEPTH - 1 || extent <= 0)
+            {
+                first[node] = start;
+                count[node] = length;
+                return node;
+            }
+            
+            for (int i = start; i < start + length; i++)
+            {
+                keys[i] = centroids[order[i] * 3 + split];
+            }
+            Array.Sort(keys, order, start, length);
+            
+            int half = length / 2;
+            Split(corners, centroids, order, keys, start, half, depth + 1);
+            first[node] = Split(corners, centroids, order, keys, start + half, length - half, depth + 1);
+            count[node] = 0;
+            return node;
+        }
+        
+        // Distance along direction (unit length) to the nearest triangle,
+        // either side facing, within maxDistance.
+        public bool Raycast(Vector3 origin, Vector3 direction, float maxDistance, out float distance)
+        {
+            distance = 0;
+            if (nodeCount == 0)
+            {
+                return false;
+            }
+            
+            float ox = origin.x, oy = origin.y, oz = origin.z;
+            float dx = direction.x, dy = direction.y, dz = direction.z;
+            // A zero component gives an infinite slab; NaN from 0 * infinity
+            // fails every rejection test, so such boxes are visited, not skipped.
+            float ix = 1f / dx, iy = 1f / dy, iz = 1f / dz;
+            float nearest = maxDistance;
+            bool hit = false;
+            
+            Span<int> stack = stackalloc int[MAX_DEPTH + 1];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0)
+            {
+                int node = stack[--top];
+                int b = node * 6;
+                float t1 = (bounds[b] - ox) * ix, t2 = (bounds[b + 3] - ox) * ix;
+                float enter = Math.Min(t1, t2), exit = Math.Max(t1, t2);
+                t1 = (bounds[b + 1] - oy) * iy;
+                t2 = (bounds[b + 4] - oy) * iy;
+                enter = Math.Max(enter, Math.Min(t1, t2));
+                exit = Math.Min(exit, Math.Max(t1, t2));
+                t1 = (bounds[b + 2] - oz) * iz;
+                t2 = (bounds[b + 5] - oz) * iz;
+                enter = Math.Max(enter, Math.Min(t1, t2));
+                exit = Math.Min(exit, Math.Max(t1, t2));
+                if (exit < enter || exit < 0 || enter > nearest)
+                {
+                    continue;
+                }
+                
+                int triangleCount = count[node];
+                if (triangleCount == 0)
+                {
+                    // Right child below left, so the left subtree is searched first.
+                    stack[top++] = first[node];
+                    stack[top++] = node + 1;
+                    continue;
+                }
+                
+                int end = (first[node] + triangleCount) * 9;
+                for (int t = first[node] * 9; t < end; t += 9)
+                {
+                    // Moller-Trumbore.
+                    float e1x = triangles[t + 3], e1y = triangles[t + 4], e1z = triangles[t + 5];
+                    float e2x = triangles[t + 6], e2y = triangles[t + 7], e2z = triangles[t + 8];
+                    float px = dy * e2z - dz * e2y, py = dz * e2x - dx * e2z, pz = dx * e2y - dy * e2x;
+                    float determinant = e1x * px + e1y * py + e1z * pz;
+                    if (determinant > -1e-12f && determinant < 1e-12f)
+                    {
+                        continue;
+                    }
+                    
+                    float inverse = 1f / determinant;
+                    float sx = ox - triangles[t], sy = oy - triangles[t + 1], sz = oz - triangles[t + 2];
+                    float u = (sx * px + sy * py + sz * pz) * inverse;
+                    if (u < 0 || u > 1)
+                    {
+                        continue;
+                    }
+                    
+                    float qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+                    float v = (dx * qx + dy * qy + dz * qz) * inverse;
+                    if (v < 0 || u + v > 1)
+                    {
+                        continue;
+                    }
+                    
+                    float along = (e2x * qx + e2y * qy + e2z * qz) * inverse;
+                    if (along > 0 && along < nearest)
+                    {
+                        nearest = along;
+                        hit = true;
+                    }
+                }
+            }
+            
+            if (hit)
+            {
+                distance = nearest;
+            }
+            return hit;
+        }
+    }
+    
+    // Follows the boxes of the last analyzed result from frame to frame, so
+    // frames between remote calls get labels that move with their objects.
+    // Each box's central patch is block-matched (sum of absolute
+    // differences, coarse to fine) against the next frame's luma, sampled
+    // at about GRID_WIDTH cells across. A track's confidence is multiplied
+    // by each match's quality; once any track falls below the minimum, or
+    // the tracks are maxFrames old, tracking stops until a new analysis
+    // seeds it again. Seeding and tracking may run on different threads.
+    private sealed class ObjectTracker
+    {
+        private const int GRID_WIDTH = 320;
+        private const int SEARCH_RADIUS = 6;
+        private const int MAX_PATCH_RADIUS = 8;
+        // Mean absolute deviation below which a patch counts as flat.
+        private const float MIN_TEXTURE = 8f;
+        
+        private DetectionResult seed;
+        private byte[] previous;
+        private int frameWidth;
+        private int frameHeight;
+        private float[] corners;
+        private float[] confidences;
+        private int age;
+        
+        // Luma of a BGRA32 frame on the tracker's grid, each cell the mean
+        // of a 2x2 block at its corner; null if the frame does not match
+        // its dimensions.
+        public static byte[] SampleLuma(ReadOnlySpan<byte> imageBytes, int width, int height)
+        {
+            GetGrid(width, height, out int factor, out int gridWidth, out int gridHeight);
+            if (gridWidth < 1 || gridHeight < 1 || imageBytes.Length != width * height * 4)
+            {
+                return null;
+            }
+            
+            ReadOnlySpan<uint> pixels = MemoryMarshal.Cast<byte, uint>(imageBytes);
+            int step = factor > 1 ? 1 : 0;
+            var luma = new byte[gridWidth * gridHeight];
+            for (int gy = 0; gy < gridHeight; gy++)
+            {
+                int row = gy * factor * width;
+                for (int gx = 0; gx < gridWidth; gx++)
+                {
+                    int x = gx * factor;
+                    luma[gy * gridWidth + gx] = (byte)((
+                        Luma(pixels[row + x]) + Luma(pixels[row + x + step]) +
+                        Luma(pixels[row + step * width + x]) + Luma(pixels[row + step * width + x + step])) >> 2);
+                }
+            }
+            return luma;
+        }
+        
+        public void Seed(DetectionResult result, byte[] luma, int width, int height)
+        {
+            var rectangles = result.Rectangles;
+            var seedCorners = new float[result.Count * 2];
+            var seedConfidences = new float[result.Count];
+            for (int i = 0; i < result.Count; i++)
+            {
+                seedCorners[i * 2] = rectangles[i * 4];
+                seedCorners[i * 2 + 1] = rectangles[i * 4 + 1];
+                seedConfidences[i] = 1f;
+            }
+            
+            lock (this)
+            {
+                seed = result.Count > 0 ? result : null;
+                previous = luma;
+                frameWidth = width;
+                frameHeight = height;
+                corners = seedCorners;
+                confidences = seedConfidences;
+                age = 0;
+            }
+        }
+        
+        // Moves the tracked boxes into the frame with the given luma, or
+        // returns null (and forgets them) once they are no longer trusted.
+        public DetectionResult Track(byte[] luma, int width, int height, int maxFrames, float minConfidence)
+        {
+            lock (this)
+            {
+                if (seed == null)
+                {
+                    return null;
+                }
+                if (width != frameWidth || height != frameHeight || ++age > maxFrames)
+                {
+                    seed = null;
+                    return null;
+                }
+                
+                GetGrid(width, height, out int factor, out int gridWidth, out int gridHeight);
+                var rectangles = seed.Rectangles;
+                for (int i = 0; i < seed.Count; i++)
+                {
+                    int radius = Math.Max(1, Math.Min(MAX_PATCH_RADIUS, Math.Min(rectangles[i * 4 + 2], rectangles[i * 4 + 3]) / (4 * factor)));
+                    int centerX = (int)((corners[i * 2] + rectangles[i * 4 + 2] * 0.5f) / factor);
+                    int centerY = (int)((corners[i * 2 + 1] + rectangles[i * 4 + 3] * 0.5f) / factor);
+                    float quality = Match(previous, luma, gridWidth, gridHeight, centerX, centerY, radius, out int dx, out int dy);
+                    
+                    confidences[i] *= quality;
+                    if (confidences[i] < minConfidence)
+                    {
+                        seed = null;
+                        return null;
+                    }
+                    corners[i * 2] += dx * factor;
+                    corners[i * 2 + 1] += dy * factor;
+                }
+                
+                previous = luma;
+                return seed.WithPositions(corners);
+            }
+        }
+        
+        // Best displacement of the patch around (centerX, centerY) from one
+        // frame to the next: every second offset in the search window, then
+        // the neighbours of the best one. Quality is 1 for an exact match and
+        // falls as the residual approaches the patch's own texture; a patch
+        // that no longer fits in the frame scores 0.
+        private static float Match(byte[] from, byte[] to, int width, int height, int centerX, int centerY, int radius,
+            out int bestX, out int bestY)
+        {
+            bestX = 0;
+            bestY = 0;
+            if (centerX - radius < 0 || centerY - radius < 0 || centerX + radius >= width || centerY + radius >= height)
+            {
+                return 0f;
+            }
+            
+            int bestSum = int.MaxValue;
+            for (int dy = -SEARCH_RADIUS; dy <= SEARCH_RADIUS; dy += 2)
+            {
+                for (int dx = -SEARCH_RADIUS; dx <= SEARCH_RADIUS; dx += 2)
+                {
+                    int sum = AbsoluteDifference(from, to, width, height, centerX, centerY, radius, dx, dy, bestSum);
+                    if (sum < bestSum)
+                    {
+                        bestSum = sum;
+                        bestX = dx;
+                        bestY = dy;
+                    }
+                }
+            }
+            
+            int coarseX = bestX, coarseY = bestY;
+            for (int dy = coarseY - 1; dy <= coarseY + 1; dy++)
+            {
+                for (int dx = coarseX - 1; dx <= coarseX + 1; dx++)
+                {
+                    int sum = AbsoluteDifference(from, to, width, height, centerX, centerY, radius, dx, dy, bestSum);
+                    if (sum < bestSum)
+                    {
+                        bestSum = sum;
+                        bestX = dx;
+                        bestY = dy;
+                    }
+                }
+            }
+            if (bestSum == int.MaxValue)
+            {
+                return 0f;
+            }
+            
+            int side = 2 * radius + 1;
+            int total = 0;
+            for (int y = centerY - radius; y <= centerY + radius; y++)
+            {
+                for (int x = centerX - radius; x <= centerX + radius; x++)
+                {
+                    total += from[y * width + x];
+                }
+            }
+            int mean = total / (side * side);
+            int deviation = 0;
+            for (int y = centerY - radius; y <= centerY + radius; y++)
+            {
+                for (int x = centerX - radius; x <= centerX + radius; x++)
+                {
+                    deviation += Math.Abs(from[y * width + x] - mean);
+                }
+            }
+            
+            float texture = Math.Max(MIN_TEXTURE, (float)deviation / (side * side));
+            float residual = (float)bestSum / (side * side);
+            return Math.Max(0f, 1f - residual / (4f * texture));
+        }
+        
+        // Stops early once the sum passes limit; int.MaxValue if the shifted
+        // patch leaves the frame.
+        private static int AbsoluteDifference(byte[] from, byte[] to, int width, int height,
+            int centerX, int centerY, int radius, int dx, int dy, int limit)
+        {
+            if (centerX + dx - radius < 0 || centerY + dy - radius < 0 || centerX + dx + radius >= width || centerY + dy + radius >= height)
+            {
+                return int.MaxValue;
+            }
+            
+            int sum = 0;
+            for (int y = -radius; y <= radius && sum < limit; y++)
+            {
+                int source = (centerY + y) * width + centerX;
+                int target = (centerY + dy + y) * width + centerX + dx;
+                for (int x = -radius; x <= radius; x++)
+                {
+                    sum += Math.Abs(from[source + x] - to[target + x]);
+                }
+            }
+            return sum;
+        }
+        
+        private static void GetGrid(int width, int height, out int factor, out int gridWidth, out int gridHeight)
+        {
+            factor = Math.Max(1, width / GRID_WIDTH);
+            gridWidth = width / factor;
+            gridHeight = height / factor;
+        }
+        
+        private static int Luma(uint pixel)
+        {
+            // BGRA32 read as a little-endian uint: 0xAARRGGBB
+            return (int)((((pixel >> 16) & 0xFF) * 77 + ((pixel >> 8) & 0xFF) * 150 + (pixel & 0xFF) * 29) >> 8);
+        }
+    }
+    
+    // Keeps one pooled label object per detection on screen. A shown result
+    // is matched against the labels already up (same label, nearest within
+    // the match radius), so an object seen again moves its label instead of
+    // replacing it; unmatched labels go back to the pool. Results shown
+    // during one rendered frame are coalesced and applied once, and text is
+    // only rewritten when the label or its rounded confidence changes.
+    // Unity objects are involved, so everything runs on the main thread.
+    private sealed class LabelManager
+    {
+        private const float WORLD_MATCH_RADIUS = 0.5f;
+        private const float IMAGE_MATCH_RADIUS = 64f;
+        private const float MIN_MOVE = 0.005f;
+        private const float FONT_SIZE = 0.25f;
+        private const int MAX_POOLED_LABELS = 256;
+        
+        private readonly Stack<HolographicLabel> pool = new Stack<HolographicLabel>();
+        private List<HolographicLabel> active = new List<HolographicLabel>();
+        private List<HolographicLabel> shown = new List<HolographicLabel>();
+        // Labels on screen chained by label ID: chains maps an ID to the first
+        // index in active, nextOfSame links to the next one.
+        private readonly Dictionary<ushort, int> chains = new Dictionary<ushort, int>();
+        private int[] nextOfSame = new int[16];
+        private bool[] claimed = new bool[16];
+        private readonly Dictionary<int, string> texts = new Dictionary<int, string>();
+        private GameObject root;
+        private DetectionResult pending;
+        private Vector3[] pendingAnchors;
+        
+        public int ActiveLabels => active.Count;
+        public int CreatedLabels { get; private set; }
+        public int TextUpdates { get; private set; }
+        
+        // anchors holds one world-space position per detection; without them
+        // (no camera pose) labels go to the box's image coordinates. Replaces
+        // any result not yet applied.
+        public void Show(DetectionResult result, Vector3[] anchors)
+        {
+            pending = result;
+            pendingAnchors = anchors;
+        }
+        
+        public void Apply()
+        {
+            var result = pending;
+            var anchors = pendingAnchors;
+            if (result == null)
+            {
+                return;
+            }
+            pending = null;
+            pendingAnchors = null;
+            
+            if (nextOfSame.Length < active.Count)
+            {
+                nextOfSame = new int[active.Count * 2];
+                claimed = new bool[active.Count * 2];
+            }
+            chains.Clear();
+            for (int i = active.Count - 1; i >= 0; i--)
+            {
+                ushort id = active[i].LabelId;
+                nextOfSame[i] = chains.TryGetValue(id, out int head) ? head : -1;
+                chains[id] = i;
+                claimed[i] = false;
+            }
+            
+            float radius = anchors != null ? WORLD_MATCH_RADIUS : IMAGE_MATCH_RADIUS;
+            var labels = result.LabelIds;
+            var confidences = result.Confidences;
+            var rectangles = result.Rectangles;
+            shown.Clear();
+            for (int i = 0; i < result.Count; i++)
+            {
+                ushort id = labels[i];
+                var position = anchors != null ? anchors[i] : new Vector3(rectangles[i * 4], rectangles[i * 4 + 1], 0);
+                
+                int match = -1;
+                float matchDistance = radius * radius;
+                for (int j = chains.TryGetValue(id, out int head) ? head : -1; j >= 0; j = nextOfSame[j])
+                {
+                    float distance = SquaredDistance(active[j].Position, position);
+                    if (!claimed[j] && distance <= matchDistance)
+                    {
+                        match = j;
+                        matchDistance = distance;
+                    }
+                }
+                
+                HolographicLabel label;
+                if (match >= 0)
+                {
+                    claimed[match] = true;
+                    label = active[match];
+                }
+                else
+                {
+                    label = Rent();
+                }
+                Update(label, id, (int)Math.Round(confidences[i] * 100), position);
+                shown.Add(label);
+            }
+            
+            for (int j = 0; j < active.Count; j++)
+            {
+                if (!claimed[j])
+                {
+                    Return(active[j]);
+                }
+            }
+            
+            var previous = active;
+            active = shown;
+            shown = previous;
+        }
+        
+        public void Clear()
+        {
+            active.Clear();
+            pool.Clear();
+            pending = null;
+            pendingAnchors = null;
+            if (root != null)
+            {
+                UnityEngine.Object.Destroy(root);
+                root = null;
+            }
+        }
+        
+        private void Update(HolographicLabel label, ushort id, int percent, Vector3 position)
+        {
+            if (label.LabelId != id || label.Percent != percent)
+            {
+                label.LabelId = id;
+                label.Percent = percent;
+                label.Text.text = GetText(id, percent);
+                TextUpdates++;
+            }
+            
+            if (SquaredDistance(label.Position, position) > MIN_MOVE * MIN_MOVE)
+            {
+                label.Position = position;
+                label.Object.transform.position = position;
+            }
+        }
+        
+        // One string per label and percentage, so steady scenes allocate none.
+        private string GetText(ushort id, int percent)
+        {
+            int key = id * 101 + percent;
+            if (!texts.TryGetValue(key, out string text))
+            {
+                text = $"{DetectionLabels.Get(id)} {percent}%";
+                texts[key] = text;
+            }
+            return text;
+        }
+        
+        private HolographicLabel Rent()
+        {
+            HolographicLabel label;
+            if (pool.Count > 0)
+            {
+                label = pool.Pop();
+                label.Object.SetActive(true);
+            }
+            else
+            {
+                if (root == null)
+                {
+                    root = new GameObject("Detection labels");
+                }
+                
+                var labelObject = new GameObject("Detection label");
+                labelObject.transform.SetParent(root.transform, false);
+                var text = labelObject.AddComponent<TextMeshPro>();
+                text.fontSize = FONT_SIZE;
+                text.alignment = TextAlignmentOptions.Center;
+                label = new HolographicLabel { Object = labelObject, Text = text };
+                CreatedLabels++;
+            }
+            
+            // Forces the first Update to write both text and position.
+            label.Percent = -1;
+            label.Position = new Vector3(float.PositiveInfinity, 0, 0);
+            return label;
+        }
+        
+        private void Return(HolographicLabel label)
+        {
+            if (pool.Count < MAX_POOLED_LABELS)
+            {
+                label.Object.SetActive(false);
+                pool.Push(label);
+            }
+            else
+            {
+                UnityEngine.Object.Destroy(label.Object);
+            }
+        }
+        
+        private static float SquaredDistance(Vector3 a, Vector3 b)
+        {
+            float dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+            return dx * dx + dy * dy + dz * dz;
+        }
+        
+        private sealed class HolographicLabel
+        {
+            public GameObject Object;
+            public TextMeshPro Text;
+            public ushort LabelId;
+            public int Percent;
+            public Vector3 Position;
+        }
+    }
+
+    // BK-tree over 64-bit perceptual hashes with Hamming distance. Nodes live in
+    // flat arrays (first-child/next-sibling) so tens of thousands of entries do
+    // not cost one heap object each. Removal leaves a tombstone; the tree is
+    // rebuilt once tombstones outnumber live entries.
+    private class PerceptualHashIndex
+    {
+        private ulong[] hashes = new ulong[64];
+        private byte[] edgeDistance = new byte[64];
+        private int[] firstChild = new int[64];
+        private int[] nextSibling = new int[64];
+        private bool[] removed = new bool[64];
+        private int nodeCount;
+        private int removedCount;
+        private readonly Stack<int> pending = new Stack<int>();
+        
+        public int Count => nodeCount - removedCount;
+        
+        public void Add(ulong hash)
+        {
+            if (nodeCount == 0)
+            {
+                AppendNode(hash, 0);
+                return;
+            }
+            
+            int node = 0;
+            while (true)
+            {
+                int distance = HammingDistance(hash, hashes[node]);
+                if (distance == 0)
+                {
+                    if (removed[node])
+                    {
+                        removed[node] = false;
+                        removedCount--;
+                    }
+                    return;
+                }
+                
+                int child = firstChild[node];
+                while (child >= 0 && edgeDistance[child] != distance)
+                {
+                    child = nextSibling[child];
+                }
+                
+                if (child < 0)
+                {
+                    int added = AppendNode(hash, distance);
+                    nextSibling[added] = firstChild[node];
+                    firstChild[node] = added;
+                    return;
+                }
+                node = child;
+            }
+        }
+        
+        public void Remove(ulong hash)
+        {
+            int node = nodeCount > 0 ? 0 : -1;
+            while (node >= 0)
+            {
+                int distance = HammingDistance(hash, hashes[node]);
+                if (distance == 0)
+                {
+                    if (!removed[node])
+                    {
+                        removed[node] = true;
+                        removedCount++;
+                    }
+                    break;
+                }
+                
+                int child = firstChild[node];
+                while (child >= 0 && edgeDistance[child] != distance)
+                {
+                    child = nextSibling[child];
+                }
+                node = child;
+            }
+            
+            if (removedCount > 0 && removedCount * 2 > nodeCount)
+            {
+                Rebuild();
+            }
+        }
+        
+        public bool TryFindNearest(ulong hash, int maxDistance, out ulong match, out int matchDistance)
+        {
+            match = 0;
+            matchDistance = int.MaxValue;
+            if (nodeCount == 0)
+            {
+                return false;
+            }
+            
+            pending.Clear();
+            pending.Push(0);
+            while (pending.Count > 0)
+            {
+                int node = pending.Pop();
+                int distance = HammingDistance(hash, hashes[node]);
+                if (distance <= maxDistance && distance < matchDistance && !removed[node])
+                {
+                    match = hashes[node];
+                    matchDistance = distance;
+                    if (distance == 0)
+                    {
+                        break;
+                    }
+                }
+                
+                // Triangle inequality: only subtrees whose edge lies within the
+                // current search radius can hold a closer hash.
+                int radius = Math.Min(maxDistance, matchDistance - 1);
+                for (int child = firstChild[node]; child >= 0; child = nextSibling[child])
+                {
+                    if (Math.Abs(edgeDistance[child] - distance) <= radius)
+                    {
+                        pending.Push(child);
+                    }
+                }
+            }
+            return matchDistance <= maxDistance;
+        }
+        
+        private int AppendNode(ulong hash, int distance)
+        {
+            if (nodeCount == hashes.Length)
+            {
+                int capacity = hashes.Length * 2;
+                Array.Resize(ref hashes, capacity);
+                Array.Resize(ref edgeDistance, capacity);
+                Array.Resize(ref firstChild, capacity);
+                Array.Resize(ref nextSibling, capacity);
+                Array.Resize(ref removed, capacity);
+            }
+            
+            int node = nodeCount++;
+            hashes[node] = hash;
+            edgeDistance[node] = (byte)distance;
+            firstChild[node] = -1;
+            nextSibling[node] = -1;
+            removed[node] = false;
+            return node;
+        }
+        
+        private void Rebuild()
+        {
+            var live = new List<ulong>(Count);
+            for (int i = 0; i < nodeCount; i++)
+            {
+                if (!removed[i]) live.Add(hashes[i]);
+            }
+            
+            nodeCount = 0;
+            removedCount = 0;
+            foreach (var hash in live)
+            {
+                Add(hash);
+            }
+        }
+        
+        private static int HammingDistance(ulong a, ulong b)
+        {
+            ulong x = a ^ b;
+            x -= (x >> 1) & 0x5555555555555555UL;
+            x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+            x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FUL;
+            return (int)((x * 0x0101010101010101UL) >> 56);
+        }
+    }
+
+    // Fixed-size cache key: a SHA-256 digest, or a Murmur128, perceptual or
+    // tile hash with its kind in the last word so the kinds never collide.
+    private readonly struct CacheKey : IEquatable<CacheKey>
+    {
+        private const ulong KIND_MURMUR128 = 1;
+        private const ulong KIND_PERCEPTUAL = 2;
+        private const ulong KIND_TILE = 3;
+        
+        private readonly ulong a;
+        private readonly ulong b;
+        private readonly ulong c;
+        private readonly ulong d;
+        
+        private CacheKey(ulong a, ulong b, ulong c, ulong d)
+        {
+            this.a = a;
+            this.b = b;
+            this.c = c;
+            this.d = d;
+        }
+        
+        // An empty key stands for "not computed"; no real key is all zeros.
+        public bool IsEmpty => (a | b | c | d) == 0;
+        
+        public static CacheKey FromSha256(ReadOnlySpan<byte> digest)
+        {
+            var words = MemoryMarshal.Cast<byte, ulong>(digest);
+            return new CacheKey(words[0], words[1], words[2], words[3]);
+        }
+        
+        public static CacheKey FromMurmur128(ulong h1, ulong h2)
+        {
+            return new CacheKey(h1, h2, 0, KIND_MURMUR128);
+        }
+        
+        public static CacheKey FromPerceptualHash(ulong perceptualHash)
+        {
+            return new CacheKey(perceptualHash, 0, 0, KIND_PERCEPTUAL);
+        }
+        
+        public static CacheKey FromTileHash(int tile, ulong tileHash)
+        {
+            return new CacheKey(tileHash, (ulong)tile, 0, KIND_TILE);
+        }
+        
+        public bool TryGetPerceptualHash(out ulong perceptualHash)
+        {
+            perceptualHash = a;
+            return d == KIND_PERCEPTUAL && b == 0 && c == 0;
+        }
+        
+        // The words are hashes already, except for perceptual and tile
+        // hashes whose bits are spatially structured, so a fold and one
+        // multiply spread them over the table.
+        public ulong Mix()
+        {
+            ulong h = (a ^ (b << 21 | b >> 43) ^ (c << 42 | c >> 22) ^ d) * 0x9E3779B97F4A7C15UL;
+            return h ^ (h >> 32);
+        }
+        
+        public bool Equals(CacheKey other)
+        {
+            return a == other.a && b == other.b && c == other.c && d == other.d;
+        }
+        
+        public override bool Equals(object obj)
+        {
+            return obj is CacheKey other && Equals(other);
+        }
+        
+        public override int GetHashCode()
+        {
+            return (int)Mix();
+        }
+        
+        public void Write(BinaryWriter writer)
+        {
+            writer.Write(a);
+            writer.Write(b);
+            writer.Write(c);
+            writer.Write(d);
+        }
+        
+        public static CacheKey Read(BinaryReader reader)
+        {
+            return new CacheKey(reader.ReadUInt64(), reader.ReadUInt64(), reader.ReadUInt64(), reader.ReadUInt64());
+        }
+        
+        public override string ToString()
+        {
+            return $"{a:x16}{b:x16}{c:x16}{d:x16}";
+        }
+    }
+    
+    // Open-addressing table keyed by CacheKey. Slots come in groups of eight
+    // with a one-byte tag each (empty, deleted, or the top bit set plus seven
+    // bits of the key's hash), packed into one ulong per group; a lookup
+    // matches all eight tags with a few word operations and compares full
+    // keys only on a tag match. Groups are probed linearly and a probe stops
+    // at the first group with an empty slot.
+    private sealed class CacheKeyTable<TValue> : IEnumerable<KeyValuePair<CacheKey, TValue>>
+    {
+        private const byte EMPTY = 0x00;
+        private const byte DELETED = 0x01;
+        private const ulong LOW_BITS = 0x0101010101010101UL;
+        private const ulong HIGH_BITS = 0x8080808080808080UL;
+        
+        private ulong[] tags;
+        private CacheKey[] keys;
+        private TValue[] values;
+        private int groupMask;
+        private int deleted;
+        
+        public CacheKeyTable(int capacity = 0)
+        {
+            Allocate(capacity);
+        }
+        
+        public int Count { get; private set; }
+        
+        public bool TryGetValue(in CacheKey key, out TValue value)
+        {
+            int slot = Find(key, key.Mix());
+            value = slot >= 0 ? values[slot] : default;
+            return slot >= 0;
+        }
+        
+        public void Add(in CacheKey key, TValue value)
+        {
+            ulong hash = key.Mix();
+            if (Find(key, hash) >= 0)
+            {
+                throw new ArgumentException("Key already present", nameof(key));
+            }
+            Insert(key, hash, value);
+        }
+        
+        public void Set(in CacheKey key, TValue value)
+        {
+            ulong hash = key.Mix();
+            int slot = Find(key, hash);
+            if (slot >= 0)
+            {
+                values[slot] = value;
+                return;
+            }
+            Insert(key, hash, value);
+        }
+        
+        public bool Remove(in CacheKey key)
+        {
+            int slot = Find(key, key.Mix());
+            if (slot < 0)
+            {
+                return false;
+            }
+            
+            // A group that still has an empty slot ends every probe that
+            // reaches it, so nothing probes past it and the slot can be
+            // emptied outright instead of leaving a tombstone.
+            int group = slot >> 3;
+            bool groupHasEmpty = MatchEmpty(tags[group]) != 0;
+            SetTag(slot, groupHasEmpty ? EMPTY : DELETED);
+            if (!groupHasEmpty)
+            {
+                deleted++;
+            }
+            keys[slot] = default;
+            values[slot] = default;
+            Count--;
+            return true;
+        }
+        
+        public void Clear()
+        {
+            Array.Clear(tags, 0, tags.Length);
+            Array.Clear(keys, 0, keys.Length);
+            Array.Clear(values, 0, values.Length);
+            Count = 0;
+            deleted = 0;
+        }
+        
+        public IEnumerator<KeyValuePair<CacheKey, TValue>> GetEnumerator()
+        {
+            for (int slot = 0; slot < keys.Length; slot++)
+            {
+                if (GetTag(slot) >= 0x80)
+                {
+                    yield return new KeyValuePair<CacheKey, TValue>(keys[slot], values[slot]);
+                }
+            }
+        }
+        
+        System.Collections.IEnumerator System.Collections.IEnumerable.GetEnumerator()
+        {
+            return GetEnumerator();
+        }
+        
+        private int Find(in CacheKey key, ulong hash)
+        {
+            ulong pattern = TagOf(hash) * LOW_BITS;
+            int group = (int)(hash >> 7) & groupMask;
+            while (true)
+            {
+                ulong word = tags[group];
+                
+                // Zero bytes of word ^ pattern are tag matches. The borrow can
+                // flag a byte above a real match; the key compare rejects it.
+                ulong difference = word ^ pattern;
+                ulong matches = (difference - LOW_BITS) & ~difference & HIGH_BITS;
+                while (matches != 0)
+                {
+                    int slot = (group << 3) + LowestByte(matches);
+                    if (keys[slot].Equals(key))
+                    {
+                        return slot;
+                    }
+                    matches &= matches - 1;
+                }
+                
+                if (MatchEmpty(word) != 0)
+                {
+                    return -1;
+                }
+                group = (group + 1) & groupMask;
+            }
+        }
+        
+        private void Insert(in CacheKey key, ulong hash, TValue value)
+        {
+            int capacity = keys.Length;
+            if ((Count + deleted + 1) * 8 > capacity * 7)
+            {
+                // Grow when live entries fill half the table, otherwise just
+                // rehash at the same size to clear out tombstones.
+                Rehash((Count + 1) * 2 > capacity ? capacity * 2 : capacity);
+            }
+            
+            int group = (int)(hash >> 7) & groupMask;
+            ulong free;
+            while ((free = ~tags[group] & HIGH_BITS) == 0)
+            {
+                group = (group + 1) & groupMask;
+            }
+            
+            int slot = (group << 3) + LowestByte(free);
+            if (GetTag(slot) == DELETED)
+            {
+                deleted--;
+            }
+            SetTag(slot, TagOf(hash));
+            keys[slot] = key;
+            values[slot] = value;
+            Count++;
+        }
+        
+        private void Rehash(int capacity)
+        {
+            var oldTags = tags;
+            var oldKeys = keys;
+            var oldValues = values;
+            Allocate(capacity);
+            
+            for (int slot = 0; slot < oldKeys.Length; slot++)
+            {
+                if ((byte)(oldTags[slot >> 3] >> ((slot & 7) * 8)) >= 0x80)
+                {
+                    Insert(oldKeys[slot], oldKeys[slot].Mix(), oldValues[slot]);
+                }
+            }
+        }
+        
+        private void Allocate(int capacity)
+        {
+            int groups = 1;
+            while (groups * 8 < capacity)
+            {
+                groups *= 2;
+            }
+            
+            tags = new ulong[groups];
+            keys = new CacheKey[groups * 8];
+            values = new TValue[groups * 8];
+            groupMask = groups - 1;
+            Count = 0;
+            deleted = 0;
+        }
+        
+        private byte GetTag(int slot)
+        {
+            return (byte)(tags[slot >> 3] >> ((slot & 7) * 8));
+        }
+        
+        private void SetTag(int slot, byte tag)
+        {
+            int shift = (slot & 7) * 8;
+            ref ulong word = ref tags[slot >> 3];
+            word = (word & ~(0xFFUL << shift)) | ((ulong)tag << shift);
+        }
+        
+        private static byte TagOf(ulong hash)
+        {
+            return (byte)(0x80 | (hash & 0x7F));
+        }
+        
+        // Non-zero iff the group has an empty slot.
+        private static ulong MatchEmpty(ulong word)
+        {
+            return (word - LOW_BITS) & ~word & HIGH_BITS;
+        }
+        
+        // Index of the lowest byte whose top bit is set in a word of 0x80 flags.
+        private static int LowestByte(ulong flags)
+        {
+            return (int)((((flags & (0UL - flags)) >> 7) * 0x0001020304050607UL) >> 56);
+        }
+    }
+    
+    // In-memory result cache, split into shards by key hash so threads that
+    // hit different shards never contend. Each shard has its own lock, table,
+    // expiry heap and insertion-ordered list, and enforces its share of the
+    // entry and byte caps. Expiry pops the min-heap on
+    // DetectionResult.Timestamp, so it only touches expired entries.
+    // Eviction is CLOCK (second chance) rather than strict LRU: a hit only
+    // sets the entry's referenced bit, and eviction walks the list from the
+    // oldest end, moving referenced entries to the newest end with the bit
+    // cleared, so the common read path does no relinking. onRemoved runs on
+    // the thread that called Set or RemoveExpired, outside the shard locks.
+    private class DetectionCache
+    {
+        private class Entry
+        {
+            public CacheKey Key;
+            public DetectionResult Value;
+            public long Bytes;
+            public int HeapIndex;
+            public bool Referenced;
+            public Entry Newer;
+            public Entry Older;
+        }
+        
+        private readonly Shard[] shards;
+        private readonly int shardMask;
+        private readonly Action<CacheKey, bool> onRemoved;
+        
+        public DetectionCache(int maxEntries, long maxBytes, Action<CacheKey, bool> onRemoved, int shardCount = 16)
+        {
+            int count = 1;
+            while (count < shardCount)
+            {
+                count *= 2;
+            }
+            
+            shards = new Shard[count];
+            for (int i = 0; i < count; i++)
+            {
+                shards[i] = new Shard(Math.Max(1, maxEntries / count), Math.Max(1, maxBytes / count));
+            }
+            shardMask = count - 1;
+            this.onRemoved = onRemoved;
+        }
+        
+        public int Count
+        {
+            get
+            {
+                int count = 0;
+                foreach (var shard in shards)
+                {
+                    count += shard.Count;
+                }
+                return count;
+            }
+        }
+        
+        public long Bytes
+        {
+            get
+            {
+                long bytes = 0;
+                foreach (var shard in shards)
+                {
+                    bytes += shard.Bytes;
+                }
+                return bytes;
+            }
+        }
+        
+        public bool TryGetValue(in CacheKey key, out DetectionResult value)
+        {
+            return ShardFor(key).TryGetValue(key, out value);
+        }
+        
+        public void Set(in CacheKey key, DetectionResult value)
+        {
+            List<Entry> removed = null;
+            ShardFor(key).Set(key, value, ref removed);
+            Notify(removed, expired: false);
+        }
+        
+        public void RemoveExpired(DateTime cutoff)
+        {
+            List<Entry> removed = null;
+            foreach (var shard in shards)
+            {
+                shard.RemoveExpired(cutoff, ref removed);
+            }
+            Notify(removed, expired: true);
+        }
+        
+        // True if every shard's table, recency list and expiry heap agree
+        // and the shard is within its caps.
+        public bool Validate()
+        {
+            foreach (var shard in shards)
+            {
+                if (!shard.Validate())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        
+        // The low bits of the mixed hash pick the table group and tag inside
+        // a shard, so shards are picked from the top bits.
+        private Shard ShardFor(in CacheKey key)
+        {
+            return shards[(int)(key.Mix() >> 56) & shardMask];
+        }
+        
+        private void Notify(List<Entry> removed, bool expired)
+        {
+            if (removed == null || onRemoved == null)
+            {
+                return;
+            }
+            foreach (var entry in removed)
+            {
+                onRemoved(entry.Key, expired);
+            }
+        }
+        
+        private sealed class Shard
+        {
+            private readonly CacheKeyTable<Entry> entries = new CacheKeyTable<Entry>();
+            private readonly List<Entry> expiryHeap = new List<Entry>();
+            private readonly int maxEntries;
+            private readonly long maxBytes;
+            private Entry newest;
+            private Entry oldest;
+            
+            public Shard(int maxEntries, long maxBytes)
+            {
+                this.maxEntries = maxEntries;
+                this.maxBytes = maxBytes;
+            }
+            
+            public int Count { get; private set; }
+            public long Bytes { get; private set; }
+            
+            public bool TryGetValue(in CacheKey key, out DetectionResult value)
+            {
+                lock (this)
+                {
+                    if (entries.TryGetValue(key, out Entry entry))
+                    {
+                        entry.Referenced = true;
+                        value = entry.Value;
+                        return true;
+                    }
+                }
+                
+                value = null;
+                return false;
+            }
+            
+            public void Set(in CacheKey key, DetectionResult value, ref List<Entry> removed)
+            {
+                var entry = new Entry { Key = key, Value = value, Bytes = value.EstimatedBytes };
+                lock (this)
+                {
+                    if (entries.TryGetValue(key, out Entry existing))
+                    {
+                        Remove(existing);
+                    }
+                    
+                    entries.Add(key, entry);
+                    LinkNewest(entry);
+                    HeapPush(entry);
+                    Bytes += entry.Bytes;
+                    Count = entries.Count;
+                    
+                    // The new entry itself is skipped like a referenced one.
+                    while (entries.Count > 1 && (entries.Count > maxEntries || Bytes > maxBytes))
+                    {
+                        var victim = oldest;
+                        if (victim.Referenced || victim == entry)
+                        {
+                            victim.Referenced = false;
+                            Unlink(victim);
+                            LinkNewest(victim);
+                            continue;
+                        }
+                        
+                        Remove(victim);
+                        (removed ?? (removed = new List<Entry>())).Add(victim);
+                    }
+                }
+            }
+            
+            public void RemoveExpired(DateTime cutoff, ref List<Entry> removed)
+            {
+                lock (this)
+                {
+                    while (expiryHeap.Count > 0 && expiryHeap[0].Value.Timestamp < cutoff)
+                    {
+                        var entry = expiryHeap[0];
+                        Remove(entry);
+                        (removed ?? (removed = new List<Entry>())).Add(entry);
+                    }
+                }
+            }
+            
+            public bool Validate()
+            {
+                lock (this)
+                {
+                    int linked = 0;
+                    long bytes = 0;
+                    for (var entry = newest; entry != null; entry = entry.Older)
+                    {
+                        if (!entries.TryGetValue(entry.Key, out Entry indexed) || indexed != entry ||
+                            entry.HeapIndex < 0 || entry.HeapIndex >= expiryHeap.Count || expiryHeap[entry.HeapIndex] != entry)
+                        {
+                            return false;
+                        }
+                        linked++;
+                        bytes += entry.Bytes;
+                    }
+                    return linked == entries.Count && linked == expiryHeap.Count && linked == Count && bytes == Bytes &&
+                        (linked <= maxEntries || linked == 1);
+                }
+            }
+            
+            private void Remove(Entry entry)
+            {
+                entries.Remove(entry.Key);
+                Unlink(entry);
+                HeapRemoveAt(entry.HeapIndex);
+                Bytes -= entry.Bytes;
+                Count = entries.Count;
+            }
+            
+            private void LinkNewest(Entry entry)
+            {
+                entry.Older = newest;
+                entry.Newer = null;
+                if (newest != null) newest.Newer = entry;
+                newest = entry;
+                if (oldest == null) oldest = entry;
+            }
+            
+            private void Unlink(Entry entry)
+            {
+                if (entry.Newer != null) entry.Newer.Older = entry.Older;
+                else newest = entry.Older;
+                
+                if (entry.Older != null) entry.Older.Newer = entry.Newer;
+                else oldest = entry.Newer;
+                
+                entry.Newer = null;
+                entry.Older = null;
+            }
+            
+            private void HeapPush(Entry entry)
+            {
+                entry.HeapIndex = expiryHeap.Count;
+                expiryHeap.Add(entry);
+                SiftUp(entry.HeapIndex);
+            }
+            
+            private void HeapRemoveAt(int index)
+            {
+                int last = expiryHeap.Count - 1;
+                if (index != last)
+                {
+                    HeapSwap(index, last);
+                }
+                expiryHeap.RemoveAt(last);
+                
+                if (index < expiryHeap.Count)
+                {
+                    SiftDown(index);
+                    SiftUp(index);
+                }
+            }
+            
+            private void SiftUp(int index)
+            {
+                while (index > 0)
+                {
+                    int parent = (index - 1) / 2;
+                    if (expiryHeap[parent].Value.Timestamp <= expiryHeap[index].Value.Timestamp) break;
+                    HeapSwap(parent, index);
+                    index = parent;
+                }
+            }
+            
+            private void SiftDown(int index)
+            {
+                while (true)
+                {
+                    int smallest = index;
+                    int left = index * 2 + 1;
+                    int right = left + 1;
+                    if (left < expiryHeap.Count && expiryHeap[left].Value.Timestamp < expiryHeap[smallest].Value.Timestamp) smallest = left;
+                    if (right < expiryHeap.Count && expiryHeap[right].Value.Timestamp < expiryHeap[smallest].Value.Timestamp) smallest = right;
+                    if (smallest == index) break;
+                    HeapSwap(smallest, index);
+                    index = smallest;
+                }
+            }
+            
+            private void HeapSwap(int a, int b)
+            {
+                Entry temp = expiryHeap[a];
+                expiryHeap[a] = expiryHeap[b];
+                expiryHeap[b] = temp;
+                expiryHeap[a].HeapIndex = a;
+                expiryHeap[b].HeapIndex = b;
+            }
+        }
+    }
+
+    // Append-only cache file. Each record is a header (magic, payload length,
+    // CRC32) followed by the 32-byte key, timestamp and serialized
+    // DetectionResult. Files from before binary keys fail the magic check
+    // and are truncated on load.
+    // The index is built on a worker thread; a torn tail from a crash fails
+    // its CRC and is truncated. Compaction writes live records to a temp file
+    // and swaps it in, so a crash mid-compaction leaves the old file intact.
+    private class PersistentDetectionStore : IDisposable
+    {
+        private const uint RECORD_MAGIC = 0x34524344; // "DCR4"
+        private const int HEADER_BYTES = 12;
+        private const long MIN_COMPACTION_BYTES = 1024 * 1024;
+        
+        private struct RecordLocation
+        {
+            public long Offset;
+            public int Length;
+            public long TimestampTicks;
+        }
+        
+        private static readonly uint[] crcTable = BuildCrcTable();
+        
+        private readonly string filePath;
+        private readonly CacheKeyTable<RecordLocation> index = new CacheKeyTable<RecordLocation>();
+        private FileStream appendStream;
+        private MemoryMappedFile mappedFile;
+        private MemoryMappedViewAccessor mappedView;
+        private long mappedLength;
+        private bool isDisposed;
+        
+        public Task<List<CacheKey>> LoadTask { get; }
+        
+        // Completes once a disposed store has closed its file.
+        public Task Closed { get; private set; } = Task.CompletedTask;
+        
+        public PersistentDetectionStore(string filePath, DateTime expiryCutoff)
+        {
+            this.filePath = filePath;
+            LoadTask = Task.Run(() => Load(expiryCutoff.Ticks));
+        }
+        
+        public bool TryRead(in CacheKey key, DateTime expiryCutoff, out DetectionResult result)
+        {
+            result = null;
+            if (isDisposed || !LoadTask.IsCompleted || LoadTask.IsFaulted ||
+                !index.TryGetValue(key, out RecordLocation location))
+            {
+                return false;
+            }
+            
+            if (location.TimestampTicks < expiryCutoff.Ticks)
+            {
+                index.Remove(key);
+                return false;
+            }
+            
+            long end = location.Offset + HEADER_BYTES + location.Length;
+            if (end > mappedLength)
+            {
+                RemapFile();
+            }
+            
+            var payload = new byte[location.Length];
+            mappedView.ReadArray(location.Offset + HEADER_BYTES, payload, 0, payload.Length);
+            
+            using (var reader = new BinaryReader(new MemoryStream(payload)))
+            {
+                CacheKey.Read(reader);
+                reader.ReadInt64();
+                result = DetectionResult.Read(reader);
+            }
+            return true;
+        }
+        
+        public void Append(in CacheKey key, DetectionResult result)
+        {
+            if (isDisposed || !LoadTask.IsCompleted || LoadTask.IsFaulted)
+            {
+                return;
+            }
+            
+            byte[] payload;
+            using (var buffer = new MemoryStream())
+            using (var writer = new BinaryWriter(buffer))
+            {
+                key.Write(writer);
+                writer.Write(result.Timestamp.Ticks);
+                result.Write(writer);
+                writer.Flush();
+                payload = buffer.ToArray();
+            }
+            
+            long offset = appendStream.Length;
+            WriteRecord(appendStream, payload);
+            appendStream.Flush();
+            
+            index.Set(key, new RecordLocation
+            {
+                Offset = offset,
+                Length = payload.Length,
+                TimestampTicks = result.Timestamp.Ticks
+            });
+        }
+        
+        private List<CacheKey> Load(long expiryCutoffTicks)
+        {
+            long validLength = 0;
+            long liveBytes = 0;
+            
+            if (File.Exists(filePath))
+            {
+                using (var stream = new FileStream(filePath, FileMode.Open, FileAccess.Read, FileShare.Read, 1 << 16))
+                using (var reader = new BinaryReader(stream))
+                {
+                    while (TryReadRecord(stream, reader, out byte[] payload))
+                    {
+                        long offset = validLength;
+                        validLength = stream.Position;
+                        
+                        CacheKey key;
+                        long timestampTicks;
+                        using (var payloadReader = new BinaryReader(new MemoryStream(payload)))
+                        {
+                            key = CacheKey.Read(payloadReader);
+                            timestampTicks = payloadReader.ReadInt64();
+                        }
+                        
+                        if (index.TryGetValue(key, out RecordLocation previous))
+                        {
+                            liveBytes -= HEADER_BYTES + previous.Length;
+                        }
+                        
+                        if (timestampTicks < expiryCutoffTicks)
+                        {
+                            index.Remove(key);
+                            continue;
+                        }
+                        
+                        index.Set(key, new RecordLocation { Offset = offset, Length = payload.Length, TimestampTicks = timestampTicks });
+                        liveBytes += HEADER_BYTES + payload.Length;
+                    }
+                }
+                
+                if (validLength > MIN_COMPACTION_BYTES && validLength - liveBytes > liveBytes)
+                {
+                    Compact(validLength);
+                    validLength = new FileInfo(filePath).Length;
+                }
+            }
+            
+            appendStream = new FileStream(filePath, FileMode.OpenOrCreate, FileAccess.ReadWrite, FileShare.Read);
+            if (appendStream.Length != validLength)
+            {
+                // Drop a record torn by a crash mid-append.
+                appendStream.SetLength(validLength);
+            }
+            appendStream.Seek(0, SeekOrigin.End);
+            RemapFile();
+            
+            var keys = new List<CacheKey>(index.Count);
+            foreach (var pair in index)
+            {
+                keys.Add(pair.Key);
+            }
+            return keys;
+        }
+        
+        private void Compact(long validLength)
+        {
+            string tempPath = filePath + ".compact";
+            var compacted = new List<KeyValuePair<CacheKey, RecordLocation>>(index.Count);
+            
+            using (var source = new FileStream(filePath, FileMode.Open, FileAccess.Read, FileShare.Read))
+            using (var target = new FileStream(tempPath, FileMode.Create, FileAccess.Write, FileShare.None))
+            {
+                var payload = new byte[256];
+                foreach (var pair in index)
+                {
+                    if (payload.Length < pair.Value.Length)
+                    {
+                        payload = new byte[pair.Value.Length];
+                    }
+                    
+                    source.Seek(pair.Value.Offset + HEADER_BYTES, SeekOrigin.Begin);
+                    ReadExactly(source, payload, pair.Value.Length);
+                    
+                    long offset = target.Position;
+                    WriteRecord(target, payload, pair.Value.Length);
+                    compacted.Add(new KeyValuePair<CacheKey, RecordLocation>(pair.Key, new RecordLocation
+                    {
+                        Offset = offset,
+                        Length = pair.Value.Length,
+                        TimestampTicks = pair.Value.TimestampTicks
+                    }));
+                }
+                target.Flush(true);
+            }
+            
+            File.Replace(tempPath, filePath, null);
+            
+            index.Clear();
+            foreach (var pair in compacted)
+            {
+                index.Set(pair.Key, pair.Value);
+            }
+        }
+        
+        private void RemapFile()
+        {
+            mappedView?.Dispose();
+            mappedFile?.Dispose();
+            mappedView = null;
+            mappedFile = null;
+            mappedLength = appendStream.Length;
+            
+            if (mappedLength > 0)
+            {
+                mappedFile = MemoryMappedFile.CreateFromFile(
+                    appendStream, null, 0, MemoryMappedFileAccess.Read, HandleInheritability.None, leaveOpen: true);
+                mappedView = mappedFile.CreateViewAccessor(0, mappedLength, MemoryMappedFileAccess.Read);
+            }
+        }
+        
+        private static bool TryReadRecord(Stream stream, BinaryReader reader, out byte[] payload)
+        {
+            payload = null;
+            if (stream.Length - stream.Position < HEADER_BYTES)
+            {
+                return false;
+            }
+            
+            uint magic = reader.ReadUInt32();
+            int length = reader.ReadInt32();
+            uint crc = reader.ReadUInt32();
+            if (magic != RECORD_MAGIC || length < 0 || length > stream.Length - stream.Position)
+            {
+                return false;
+            }
+            
+            payload = reader.ReadBytes(length);
+            return Crc32(payload, length) == crc;
+        }
+        
+        private static void WriteRecord(Stream stream, byte[] payload)
+        {
+            WriteRecord(stream, payload, payload.Length);
+        }
+        
+        private static void WriteRecord(Stream stream, byte[] payload, int length)
+        {
+            var header = new byte[HEADER_BYTES];
+            BitConverter.TryWriteBytes(new Span<byte>(header, 0, 4), RECORD_MAGIC);
+            BitConverter.TryWriteBytes(new Span<byte>(header, 4, 4), length);
+            BitConverter.TryWriteBytes(new Span<byte>(header, 8, 4), Crc32(payload, length));
+            stream.Write(header, 0, HEADER_BYTES);
+            stream.Write(payload, 0, length);
+        }
+        
+        private static void ReadExactly(Stream stream, byte[] buffer, int count)
+        {
+            int read = 0;
+            while (read < count)
+            {
+                int n = stream.Read(buffer, read, count - read);
+                if (n == 0) throw new EndOfStreamException();
+                read += n;
+            }
+        }
+        
+        private static uint Crc32(byte[] data, int length)
+        {
+            uint crc = 0xFFFFFFFF;
+            for (int i = 0; i < length; i++)
+            {
+                crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+        
+        private static uint[] BuildCrcTable()
+        {
+            var table = new uint[256];
+            for (uint i = 0; i < 256; i++)
+            {
+                uint c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = (c & 1) != 0 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                table[i] = c;
+            }
+            return table;
+        }
+        
+        public void Dispose()
+        {
+            if (isDisposed)
+                return;
+            
+            isDisposed = true;
+            Closed = LoadTask.ContinueWith(_ =>
+            {
+                mappedView?.Dispose();
+                mappedFile?.Dispose();
+                appendStream?.Dispose();
+            });
+        }
+    }
+
+    // Only frames that reach the display count towards latency and throughput.
+    // Per-frame work handed to a pool thread. What it allocates there is
+    // added to workerAllocatedBytes, since GC.GetAllocatedBytesForCurrentThread
+    // on the main thread cannot see it.
+    private static Task<T> RunOnWorker<T>(Func<T> work, CancellationToken cancellationToken = default)
+    {
+        return Task.Run(() =>
+        {
+            long before = GC.GetAllocatedBytesForCurrentThread();
+            try
+            {
+                return work();
+            }
+            finally
+            {
+                Interlocked.Add(ref workerAllocatedBytes, GC.GetAllocatedBytesForCurrentThread() - before);
+            }
+        }, cancellationToken);
+    }
+    
+    private static Task RunOnWorker(Action work, CancellationToken cancellationToken = default)
+    {
+        return RunOnWorker(() =>
+        {
+            work();
+            return true;
+        }, cancellationToken);
+    }
+    
+    private static long CountedAllocatedBytes()
+    {
+        return GC.GetAllocatedBytesForCurrentThread() + Interlocked.Read(ref workerAllocatedBytes);
+    }
+    
+    private async Task<bool> TimeRequest(LatencyRecorder latencies, Stopwatch clock)
+    {
+        long start = clock.ElapsedTicks;
+        bool displayed = await SubmitFrame();
+        if (displayed)
+        {
+            latencies.Record(clock.ElapsedTicks - start);
+        }
+        return displayed;
+    }
+    
+    public enum UploadEncoding
+    {
+        Raw,
+        Jpeg,
+        Png
+    }
+    
+    public enum CacheKeyHash
+    {
+        Sha256,
+        Murmur128
+    }
+    
+    [Serializable]
+    public struct StageLimits
+    {
+        public int queueDepth;
+        public int maxInFlight;
+        
+        public StageLimits(int queueDepth, int maxInFlight)
+        {
+            this.queueDepth = queueDepth;
+            this.maxInFlight = maxInFlight;
+        }
+    }
+    
+    public struct PipelineStageStats
+    {
+        public string Name;
+        public int QueueDepth;
+        public int InFlight;
+        public int Processed;
+        public int Dropped;
+        public double P50Milliseconds;
+        public double P99Milliseconds;
+        
+        public override string ToString()
+        {
+            return $"{Name}: queue {QueueDepth}, in flight {InFlight}, processed {Processed}, dropped {Dropped}, " +
+                $"p50 {P50Milliseconds:F1} ms, p99 {P99Milliseconds:F1} ms";
+        }
+    }
+    
+    // State for one frame as it moves through the pipeline.
+    private class FrameJob
+    {
+        private readonly TaskCompletionSource<bool> completion =
+            new TaskCompletionSource<bool>(TaskCreationOptions.RunContinuationsAsynchronously);
+        private readonly CancellationTokenSource cancellation = new CancellationTokenSource();
+        
+        public FrameJob(long sequence)
+        {
+            Sequence = sequence;
+        }
+        
+        public long Sequence { get; }
+        
+        // Passed to every worker and remote call made for this frame.
+        public CancellationToken Token => cancellation.Token;
+        
+        public FrameBuffer Frame;
+        public FrameBuffer UploadFrame;
+        public float UploadScale = 1f;
+        public Resolution Resolution;
+        public CameraPose Pose;
+        public Vector3[] Anchors;
+        // Tracker luma of this frame, and whether Result came from tracking
+        // rather than analysis.
+        public byte[] TrackLuma;
+        public bool IsTracked;
+        // True when Result describes this frame's own content: analyzed
+        // remotely or locally, or a cache hit on its key. False for results
+        // carried over from an earlier frame (scene gate, tracker, fallback).
+        public bool IsFresh;
+        // Fills in the keys below, alongside the scene and track stages with
+        // overlapHashing. HashAbandoned is set once they resolve the frame so
+        // an exact hash stops early.
+        public Task HashTask;
+        public volatile bool HashAbandoned;
+        public bool IsPerceptual;
+        public ulong PerceptualHash;
+        public byte[] SceneThumbnail;
+        
+        // 0 for a frame that barely cleared the scene gate, 1 for a new view
+        // or when the gate is off. Decides who gets scarce budget.
+        public float Novelty = 1f;
+        public DetectionResult LocalFallback;
+        public CacheKey CacheKey;
+        // Hit found by the hash worker's probe of the in-memory cache.
+        public DetectionResult CachedResult;
+        public DetectionResult Result;
+        
+        // Set in tiled mode: per-tile keys and results (null on a miss), and
+        // the mosaic placement of the tiles that were uploaded.
+        public CacheKey[] TileKeys;
+        public DetectionResult[] TileResults;
+        public int TileColumns;
+        public int TileRows;
+        public List<int> ChangedTiles;
+        public MosaicTile[] UploadTiles;
+        
+        // True once the frame was displayed, false if it was dropped, failed or
+        // was cancelled.
+        public Task<bool> Completion => completion.Task;
+        
+        // Returns false if the frame had already finished or been cancelled.
+        public bool Cancel()
+        {
+            if (completion.Task.IsCompleted || cancellation.IsCancellationRequested)
+            {
+                return false;
+            }
+            cancellation.Cancel();
+            return true;
+        }
+        
+        public void Complete(bool processed)
+        {
+            HashAbandoned = true;
+            if (completion.TrySetResult(processed))
+            {
+                Frame?.Release();
+                UploadFrame?.Release();
+                Frame = null;
+                UploadFrame = null;
+            }
+        }
+    }
+    
+    // Whole-frame exact keys, hashed in CHUNK_BYTES pieces so a speculative
+    // hash stops within a chunk of being abandoned. SHA-256 hashers are kept
+    // per thread instead of created per frame.
+    private static class FrameHasher
+    {
+        // A multiple of the 16-byte Murmur block, so only the last chunk has a tail.
+        private const int CHUNK_BYTES = 256 * 1024;
+        private const ulong MURMUR_C1 = 0x87c37b91114253d5UL;
+        private const ulong MURMUR_C2 = 0x4cf5ad432745937fUL;
+        
+        [ThreadStatic] private static IncrementalHash sha256;
+        
+        // Returns an empty key if abandoned() reports true between chunks.
+        public static CacheKey Hash(ReadOnlySpan<byte> data, CacheKeyHash algorithm, Func<bool> abandoned)
+        {
+            return algorithm == CacheKeyHash.Sha256 ? HashSha256(data, abandoned) : HashMurmur128(data, abandoned);
+        }
+        
+        private static CacheKey HashSha256(ReadOnlySpan<byte> data, Func<bool> abandoned)
+        {
+            var hasher = sha256 ?? (sha256 = IncrementalHash.CreateHash(HashAlgorithmName.SHA256));
+            Span<byte> digest = stackalloc byte[32];
+            for (int offset = 0; offset < data.Length; offset += CHUNK_BYTES)
+            {
+                if (abandoned != null && abandoned())
+                {
+                    hasher.TryGetHashAndReset(digest, out _);
+                    return default;
+                }
+                hasher.AppendData(data.Slice(offset, Math.Min(CHUNK_BYTES, data.Length - offset)));
+            }
+            hasher.TryGetHashAndReset(digest, out _);
+            return CacheKey.FromSha256(digest);
+        }
+        
+        // MurmurHash3 x64-128 with seed 0; frames are read as little-endian words.
+        private static CacheKey HashMurmur128(ReadOnlySpan<byte> data, Func<bool> abandoned)
+        {
+            ulong h1 = 0;
+            ulong h2 = 0;
+            int blockBytes = data.Length & ~15;
+            for (int offset = 0; offset < blockBytes; offset += CHUNK_BYTES)
+            {
+                if (abandoned != null && abandoned())
+                {
+                    return default;
+                }
+                
+                var words = MemoryMarshal.Cast<byte, ulong>(data.Slice(offset, Math.Min(CHUNK_BYTES, blockBytes - offset)));
+                for (int i = 0; i < words.Length; i += 2)
+                {
+                    h1 ^= MixK1(words[i]);
+                    h1 = RotateLeft(h1, 27) + h2;
+                    h1 = h1 * 5 + 0x52dce729;
+                    h2 ^= MixK2(words[i + 1]);
+                    h2 = RotateLeft(h2, 31) + h1;
+                    h2 = h2 * 5 + 0x38495ab5;
+                }
+            }
+            
+            var tail = data.Slice(blockBytes);
+            if (tail.Length > 0)
+            {
+                Span<byte> padded = stackalloc byte[16];
+                tail.CopyTo(padded);
+                var words = MemoryMarshal.Cast<byte, ulong>(padded);
+                if (tail.Length > 8)
+                {
+                    h2 ^= MixK2(words[1]);
+                }
+                h1 ^= MixK1(words[0]);
+            }
+            
+            h1 ^= (ulong)data.Length;
+            h2 ^= (ulong)data.Length;
+            h1 += h2;
+            h2 += h1;
+            h1 = FinalMix(h1);
+            h2 = FinalMix(h2);
+            h1 += h2;
+            h2 += h1;
+            
+            return CacheKey.FromMurmur128(h1, h2);
+        }
+        
+        private static ulong MixK1(ulong k)
+        {
+            return RotateLeft(k * MURMUR_C1, 31) * MURMUR_C2;
+        }
+        
+        private static ulong MixK2(ulong k)
+        {
+            return RotateLeft(k * MURMUR_C2, 33) * MURMUR_C1;
+        }
+        
+        private static ulong FinalMix(ulong k)
+        {
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdUL;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53UL;
+            k ^= k >> 33;
+            return k;
+        }
+        
+        private static ulong RotateLeft(ulong value, int bits)
+        {
+            return (value << bits) | (value >> (64 - bits));
+        }
+    }
+    
+    // Reference-counted frame storage rented from a dedicated pool (the shared
+    // pool does not retain multi-megabyte arrays). The frame is written once at
+    // capture; hashing reads the span and upload wraps the same array in a
+    // read-only MemoryStream, so no stage copies the pixels.
+    private sealed class FrameBuffer
+    {
+        private const int MAX_POOLED_FRAME_BYTES = 64 * 1024 * 1024;
+        private static readonly ArrayPool<byte> pool = ArrayPool<byte>.Create(MAX_POOLED_FRAME_BYTES, 4);
+        
+        private readonly bool pooled;
+        private int refCount = 1;
+        
+        public byte[] Array { get; private set; }
+        public int Length { get; }
+        public ReadOnlySpan<byte> Span => new ReadOnlySpan<byte>(Array, 0, Length);
+        
+        // Off only while RunReplayLoad measures the copy path: Rent then
+        // allocates a fresh array every time, as every frame, downscale and
+        // mosaic buffer was allocated before pooling.
+        public static bool Pooling { get; set; } = true;
+        
+        private FrameBuffer(byte[] array, int length, bool pooled)
+        {
+            Array = array;
+            Length = length;
+            this.pooled = pooled;
+        }
+        
+        public static FrameBuffer Rent(int length)
+        {
+            return Pooling
+                ? new FrameBuffer(pool.Rent(length), length, pooled: true)
+                : new FrameBuffer(new byte[length], length, pooled: false);
+        }
+        
+        // Wraps caller-owned bytes (e.g. replayed frames); they are never pooled.
+        public static FrameBuffer Wrap(byte[] bytes)
+        {
+            return new FrameBuffer(bytes, bytes.Length, pooled: false);
+        }
+        
+        public FrameBuffer AddRef()
+        {
+            Interlocked.Increment(ref refCount);
+            return this;
+        }
+        
+        public void Release()
+        {
+            int remaining = Interlocked.Decrement(ref refCount);
+            if (remaining == 0 && pooled)
+            {
+                pool.Return(Array);
+                Array = null;
+            }
+        }
+        
+        public MemoryStream OpenReadStream()
+        {
+            return new MemoryStream(Array, 0, Length, writable: false, publiclyVisible: true);
+        }
+    }
+    
+    // Chooses among the camera's resolutions, smallest first. It starts at
+    // the smallest one that still fills an upload; anything larger is
+    // downscaled before sending, so it only adds capture, hashing and copy
+    // time. After each window of completed frames it moves one step: down
+    // while end-to-end latency is over target, and back up, never past the
+    // starting profile, while analyzed detections are less confident than
+    // the target and latency has room.
+    private sealed class CaptureProfileSelector
+    {
+        private readonly Resolution[] resolutions;
+        private readonly CapturePixelFormat format;
+        private readonly int windowFrames;
+        private readonly int ceiling;
+        private LatencyRecorder latency;
+        private double confidenceSum;
+        private int confidenceSamples;
+        private int index;
+        
+        public CaptureProfileSelector(IEnumerable<Resolution> supported, CapturePixelFormat format, int uploadLongEdge, int windowFrames)
+        {
+            resolutions = supported
+                .GroupBy(r => (r.width, r.height))
+                .Select(g => g.First())
+                .OrderBy(r => r.width * r.height)
+                .ToArray();
+            if (resolutions.Length == 0)
+            {
+                throw new ArgumentException("No capture resolutions", nameof(supported));
+            }
+            
+            this.format = format;
+            this.windowFrames = Math.Max(1, windowFrames);
+            latency = new LatencyRecorder(this.windowFrames);
+            index = resolutions.Length - 1;
+            for (int i = 0; i < resolutions.Length; i++)
+            {
+                if (Math.Max(resolutions[i].width, resolutions[i].height) >= uploadLongEdge)
+                {
+                    index = i;
+                    break;
+                }
+            }
+            ceiling = index;
+        }
+        
+        public CaptureProfile Current => new CaptureProfile(resolutions[index].width, resolutions[index].height, format);
+        
+        public void RecordConfidence(float meanConfidence)
+        {
+            confidenceSum += meanConfidence;
+            confidenceSamples++;
+        }
+        
+        // Returns true when the window closed with a different profile.
+        public bool RecordLatency(long elapsedTicks, float targetMilliseconds, float targetConfidence)
+        {
+            latency.Record(elapsedTicks);
+            if (latency.Count < windowFrames)
+            {
+                return false;
+            }
+            
+            double p50 = latency.PercentileMilliseconds(50);
+            double confidence = confidenceSamples > 0 ? confidenceSum / confidenceSamples : 1;
+            latency = new LatencyRecorder(windowFrames);
+            confidenceSum = 0;
+            confidenceSamples = 0;
+            
+            int previous = index;
+            if (p50 > targetMilliseconds * 1.1 && index > 0)
+            {
+                index--;
+            }
+            else if (confidence < targetConfidence && p50 < targetMilliseconds * 0.7 && index < ceiling)
+            {
+                index++;
+            }
+            return index != previous;
+        }
+    }
+    
+    // The newest frames from a continuous source. A full ring overwrites its
+    // oldest frame. Take hands out the newest frame not handed out before,
+    // waiting for one only if there is none, so the pipeline never waits on
+    // a shutter and never gets the same frame twice. Frames it moves past
+    // are counted as skipped.
+    private sealed class FrameRing
+    {
+        private readonly FrameBuffer[] frames;
+        private readonly CameraPose[] poses;
+        private readonly long[] capturedTicks;
+        private long written;
+        private long taken;
+        private bool closed;
+        private TaskCompletionSource<bool> arrival = new TaskCompletionSource<bool>(TaskCreationOptions.RunContinuationsAsynchronously);
+        
+        public FrameRing(int capacity)
+        {
+            capacity = Math.Max(1, capacity);
+            frames = new FrameBuffer[capacity];
+            poses = new CameraPose[capacity];
+            capturedTicks = new long[capacity];
+        }
+        
+        public long SkippedFrames { get; private set; }
+        
+        // Takes ownership of frame. capturedAt is a Stopwatch timestamp.
+        public void Push(FrameBuffer frame, CameraPose pose, long capturedAt)
+        {
+            TaskCompletionSource<bool> waiting;
+            lock (this)
+            {
+                if (closed)
+                {
+                    frame.Release();
+                    return;
+                }
+                
+                int slot = (int)(written % frames.Length);
+                frames[slot]?.Release();
+                frames[slot] = frame;
+                poses[slot] = pose;
+                capturedTicks[slot] = capturedAt;
+                written++;
+                
+                waiting = arrival;
+                arrival = new TaskCompletionSource<bool>(TaskCreationOptions.RunContinuationsAsynchronously);
+            }
+            waiting.TrySetResult(true);
+        }
+        
+        // The caller releases the returned frame. Returns a null frame once
+        // the ring is closed, including to callers already waiting.
+        public async Task<(FrameBuffer Frame, CameraPose Pose, long CapturedAt)> TakeAsync(CancellationToken cancellationToken)
+        {
+            while (true)
+            {
+                Task next;
+                lock (this)
+                {
+                    if (closed)
+                    {
+                        return (null, default, 0);
+                    }
+                    if (written > taken)
+                    {
+                        int slot = (int)((written - 1) % frames.Length);
+                        SkippedFrames += written - taken - 1;
+                        taken = written;
+                        return (frames[slot].AddRef(), poses[slot], capturedTicks[slot]);
+                    }
+                    next = arrival.Task;
+                }
+                
+                // The registration is scoped to this wait, so nothing stays
+                // attached to a long-lived token between frames.
+                var cancelled = new TaskCompletionSource<bool>(TaskCreationOptions.RunContinuationsAsynchronously);
+                using (cancellationToken.Register(() => cancelled.TrySetResult(true)))
+                {
+                    await Task.WhenAny(next, cancelled.Task);
+                }
+                cancellationToken.ThrowIfCancellationRequested();
+            }
+        }
+        
+        // Releases the buffered frames and wakes every waiter; frames pushed
+        // afterwards are dropped.
+        public void Close()
+        {
+            TaskCompletionSource<bool> waiting;
+            lock (this)
+            {
+                for (int i = 0; i < frames.Length; i++)
+                {
+                    frames[i]?.Release();
+                    frames[i] = null;
+                }
+                taken = written;
+                closed = true;
+                waiting = arrival;
+            }
+            waiting.TrySetResult(false);
+        }
+    }
+    
+    // A continuous frame source feeding a FrameRing until cancelled or disposed.
+    private interface IFrameStream : IDisposable
+    {
+        Resolution Resolution { get; }
+        
+        // BGRA32 or NV12.
+        CapturePixelFormat Format { get; }
+        
+        Task StartAsync(FrameRing ring, CancellationToken cancellationToken);
+    }
+    
+    // Plays a file written by RecordFrames at its recorded rate, optionally
+    // looping, so video mode can be exercised without a camera.
+    private sealed class RecordedFrameStream : IFrameStream
+    {
+        public const uint MAGIC = 0x31535256; // "VRS1"
+        
+        private readonly string path;
+        private readonly bool loop;
+        private readonly float framesPerSecond;
+        private readonly CancellationTokenSource stop = new CancellationTokenSource();
+        
+        public RecordedFrameStream(string path, bool loop)
+        {
+            this.path = path;
+            this.loop = loop;
+            using (var reader = new BinaryReader(File.OpenRead(path)))
+            {
+                if (reader.ReadUInt32() != MAGIC)
+                {
+                    throw new InvalidDataException($"{path} is not a recorded frame stream");
+                }
+                Resolution = new Resolution { width = reader.ReadInt32(), height = reader.ReadInt32() };
+                framesPerSecond = reader.ReadSingle();
+            }
+        }
+        
+        public Resolution Resolution { get; }
+        
+        public CapturePixelFormat Format => CapturePixelFormat.BGRA32;
+        
+        public Task StartAsync(FrameRing ring, CancellationToken cancellationToken)
+        {
+            var token = CancellationTokenSource.CreateLinkedTokenSource(cancellationToken, stop.Token).Token;
+            var playback = Task.Run(() => Play(ring, token));
+            Observe(playback);
+            return Task.CompletedTask;
+        }
+        
+        private async Task Play(FrameRing ring, CancellationToken cancellationToken)
+        {
+            const int HEADER_BYTES = 16;
+            int frameBytes = Resolution.width * Resolution.height * 4;
+            long interval = (long)(Stopwatch.Frequency / Math.Max(1f, framesPerSecond));
+            long due = Stopwatch.GetTimestamp();
+            
+            using (var stream = new FileStream(path, FileMode.Open, FileAccess.Read, FileShare.Read, 1 << 16))
+            using (var reader = new BinaryReader(stream))
+            {
+                stream.Position = HEADER_BYTES;
+                while (!cancellationToken.IsCancellationRequested)
+                {
+                    if (stream.Position >= stream.Length)
+                    {
+                        if (!loop || stream.Length == HEADER_BYTES)
+                        {
+                            return;
+                        }
+                        stream.Position = HEADER_BYTES;
+                    }
+                    
+                    long wait = due - Stopwatch.GetTimestamp();
+                    if (wait > 0)
+                    {
+                        await Task.Delay(TimeSpan.FromSeconds((double)wait / Stopwatch.Frequency), cancellationToken);
+                    }
+                    long capturedAt = Stopwatch.GetTimestamp();
+                    // A stalled reader does not get to burst through the backlog.
+                    due = Math.Max(due + interval, capturedAt);
+                    
+                    var pose = ReadPose(reader);
+                    var frame = FrameBuffer.Rent(frameBytes);
+                    for (int read = 0; read < frameBytes; )
+                    {
+                        int chunk = stream.Read(frame.Array, read, frameBytes - read);
+                        if (chunk == 0)
+                        {
+                            frame.Release();
+                            throw new EndOfStreamException($"{path} ends inside a frame");
+                        }
+                        read += chunk;
+                    }
+                    ring.Push(frame, pose, capturedAt);
+                }
+            }
+        }
+        
+        // Layout: magic, width, height, frames per second, then per frame a
+        // pose flag, 32 floats of pose when set, and the BGRA32 pixels.
+        public static void Write(string path, Resolution resolution, float framesPerSecond,
+            IReadOnlyList<byte[]> frames, IReadOnlyList<CameraPose> poses)
+        {
+            using (var writer = new BinaryWriter(new FileStream(path, FileMode.Create, FileAccess.Write, FileShare.None, 1 << 16)))
+            {
+                writer.Write(MAGIC);
+                writer.Write(resolution.width);
+                writer.Write(resolution.height);
+                writer.Write(framesPerSecond);
+                for (int i = 0; i < frames.Count; i++)
+                {
+                    if (frames[i].Length != resolution.width * resolution.height * 4)
+                    {
+                        throw new ArgumentException($"Frame {i} is not {resolution.width}x{resolution.height} BGRA32", nameof(frames));
+                    }
+                    
+                    var pose = poses != null && i < poses.Count ? poses[i] : default;
+                    writer.Write(pose.IsValid);
+                    if (pose.IsValid)
+                    {
+                        for (int j = 0; j < 16; j++) writer.Write(pose.CameraToWorld[j]);
+                        for (int j = 0; j < 16; j++) writer.Write(pose.Projection[j]);
+                    }
+                    writer.Write(frames[i]);
+                }
+            }
+        }
+        
+        private static CameraPose ReadPose(BinaryReader reader)
+        {
+            if (!reader.ReadBoolean())
+            {
+                return default;
+            }
+            
+            var cameraToWorld = new Matrix4x4();
+            var projection = new Matrix4x4();
+            for (int j = 0; j < 16; j++) cameraToWorld[j] = reader.ReadSingle();
+            for (int j = 0; j < 16; j++) projection[j] = reader.ReadSingle();
+            return new CameraPose(cameraToWorld, projection);
+        }
+        
+        public void Dispose()
+        {
+            stop.Cancel();
+        }
+    }
+    
+#if ENABLE_WINMD_SUPPORT
+    // Streams the PV camera through a MediaFrameReader. Each frame, in NV12
+    // or converted to BGRA8 by the reader, is copied once into a pooled
+    // FrameBuffer; the pose comes from the frame's coordinate system
+    // relative to Unity's world origin and from the camera intrinsics.
+    private sealed class MediaFrameStream : IFrameStream
+    {
+        private readonly SpatialCoordinateSystem worldOrigin;
+        private MediaCapture capture;
+        private MediaFrameReader reader;
+        private FrameRing ring;
+        
+        // worldOrigin must be fetched on the main thread.
+        public MediaFrameStream(Resolution resolution, CapturePixelFormat format, SpatialCoordinateSystem worldOrigin)
+        {
+            Resolution = resolution;
+            Format = format == CapturePixelFormat.NV12 ? CapturePixelFormat.NV12 : CapturePixelFormat.BGRA32;
+            this.worldOrigin = worldOrigin;
+        }
+        
+        public Resolution Resolution { get; private set; }
+        
+        public CapturePixelFormat Format { get; }
+        
+        public async Task StartAsync(FrameRing ring, CancellationToken cancellationToken)
+        {
+            this.ring = ring;
+            MediaFrameSourceGroup group = null;
+            MediaFrameSourceInfo colorSource = null;
+            foreach (var candidate in await MediaFrameSourceGroup.FindAllAsync())
+            {
+                colorSource = candidate.SourceInfos.FirstOrDefault(info =>
+                    info.MediaStreamType == MediaStreamType.VideoRecord && info.SourceKind == MediaFrameSourceKind.Color);
+                if (colorSource != null)
+                {
+                    group = candidate;
+                    break;
+                }
+            }
+            if (group == null)
+            {
+                throw new InvalidOperationException("No color camera found");
+            }
+            
+            capture = new MediaCapture();
+            await capture.InitializeAsync(new MediaCaptureInitializationSettings
+            {
+                SourceGroup = group,
+                SharingMode = MediaCaptureSharingMode.ExclusiveControl,
+                MemoryPreference = MediaCaptureMemoryPreference.Cpu,
+                StreamingCaptureMode = StreamingCaptureMode.Video
+            });
+            cancellationToken.ThrowIfCancellationRequested();
+            
+            var source = capture.FrameSources[colorSource.Id];
+            var format = source.SupportedFormats
+                .Where(f => f.VideoFormat.Width == Resolution.width && f.VideoFormat.Height == Resolution.height)
+                .OrderByDescending(f => (double)f.FrameRate.Numerator / f.FrameRate.Denominator)
+                .FirstOrDefault();
+            if (format != null)
+            {
+                await source.SetFormatAsync(format);
+            }
+            Resolution = new Resolution { width = (int)source.CurrentFormat.VideoFormat.Width, height = (int)source.CurrentFormat.VideoFormat.Height };
+            
+            reader = await capture.CreateFrameReaderAsync(source,
+                Format == CapturePixelFormat.NV12 ? MediaEncodingSubtypes.Nv12 : MediaEncodingSubtypes.Bgra8);
+            reader.AcquisitionMode = MediaFrameReaderAcquisitionMode.Realtime;
+            reader.FrameArrived += OnFrameArrived;
+            var status = await reader.StartAsync();
+            if (status != MediaFrameReaderStartStatus.Success)
+            {
+                throw new IOException($"Camera stream failed to start: {status}");
+            }
+        }
+        
+        private void OnFrameArrived(MediaFrameReader sender, MediaFrameArrivedEventArgs args)
+        {
+            using (var reference = sender.TryAcquireLatestFrame())
+            {
+                var bitmap = reference?.VideoMediaFrame?.SoftwareBitmap;
+                if (bitmap == null || bitmap.PixelWidth != Resolution.width || bitmap.PixelHeight != Resolution.height)
+                {
+                    return;
+                }
+                
+                int pixels = bitmap.PixelWidth * bitmap.PixelHeight;
+                int length = Format == CapturePixelFormat.NV12 ? pixels * 3 / 2 : pixels * 4;
+                var frame = FrameBuffer.Rent(length);
+                bitmap.CopyToBuffer(frame.Array.AsBuffer(0, length));
+                
+                // SystemRelativeTime is QPC time, the same clock as Stopwatch.
+                long capturedAt = reference.SystemRelativeTime.HasValue
+                    ? reference.SystemRelativeTime.Value.Ticks * Stopwatch.Frequency / TimeSpan.TicksPerSecond
+                    : Stopwatch.GetTimestamp();
+                ring.Push(frame, GetPose(reference), capturedAt);
+            }
+        }
+        
+        private CameraPose GetPose(MediaFrameReference reference)
+        {
+            var intrinsics = reference.VideoMediaFrame.CameraIntrinsics;
+            var toWorld = worldOrigin != null ? reference.CoordinateSystem?.TryGetTransformTo(worldOrigin) : null;
+            if (intrinsics == null || !toWorld.HasValue)
+            {
+                return default;
+            }
+            
+            // WinRT matrices act on row vectors in a right-handed world; Unity's
+            // act on column vectors in a left-handed one. Camera space stays
+            // right-handed (looking down -z), as PhotoCapture reports it.
+            var m = toWorld.Value;
+            var cameraToWorld = new Matrix4x4
+            {
+                m00 = m.M11, m01 = m.M21, m02 = m.M31, m03 = m.M41,
+                m10 = m.M12, m11 = m.M22, m12 = m.M32, m13 = m.M42,
+                m20 = -m.M13, m21 = -m.M23, m22 = -m.M33, m23 = -m.M43,
+                m33 = 1
+            };
+            
+            // Pinhole intrinsics as the projection ProjectToWorld inverts.
+            float width = Resolution.width, height = Resolution.height;
+            var projection = new Matrix4x4
+            {
+                m00 = 2f * intrinsics.FocalLength.X / width,
+                m02 = 1f - 2f * intrinsics.PrincipalPoint.X / width,
+                m11 = 2f * intrinsics.FocalLength.Y / height,
+                m12 = 2f * intrinsics.PrincipalPoint.Y / height - 1f,
+                m22 = -1f,
+                m32 = -1f
+            };
+            return new CameraPose(cameraToWorld, projection);
+        }
+        
+        public void Dispose()
+        {
+            if (reader != null)
+            {
+                reader.FrameArrived -= OnFrameArrived;
+                _ = reader.StopAsync();
+                reader.Dispose();
+                reader = null;
+            }
+            capture?.Dispose();
+            capture = null;
+        }
+    }
+#endif
+    
+    // One pipeline stage: a bounded queue drained by up to maxInFlight
+    // concurrent workers. Each worker returns the stage the frame moves to
+    // next, or null once the frame is finished. When the queue is full the
+    // oldest queued frame is dropped in favour of the new one.
+    private class PipelineStage
+    {
+        private readonly string name;
+        private readonly int queueDepth;
+        private readonly int maxInFlight;
+        private readonly Func<FrameJob, Task<PipelineStage>> work;
+        private readonly Queue<FrameJob> queue = new Queue<FrameJob>();
+        private readonly LatencyRecorder latency = new LatencyRecorder(1024);
+        private int inFlight;
+        private int processed;
+        private int dropped;
+        
+        public PipelineStage(string name, StageLimits limits, Func<FrameJob, Task<PipelineStage>> work)
+        {
+            this.name = name;
+            this.queueDepth = Math.Max(1, limits.queueDepth);
+            this.maxInFlight = Math.Max(1, limits.maxInFlight);
+            this.work = work;
+        }
+        
+        public void Post(FrameJob job)
+        {
+            FrameJob stale = null;
+            lock (queue)
+            {
+                if (queue.Count >= queueDepth)
+                {
+                    stale = queue.Dequeue();
+                    dropped++;
+                }
+                queue.Enqueue(job);
+            }
+            
+            stale?.Complete(false);
+            Pump();
+        }
+        
+        public void Clear()
+        {
+            List<FrameJob> pending;
+            lock (queue)
+            {
+                pending = new List<FrameJob>(queue);
+                dropped += queue.Count;
+                queue.Clear();
+            }
+            
+            foreach (var job in pending)
+            {
+                job.Complete(false);
+            }
+        }
+        
+        public PipelineStageStats GetStats()
+        {
+            lock (queue)
+            {
+                return new PipelineStageStats
+                {
+                    Name = name,
+                    QueueDepth = queue.Count,
+                    InFlight = inFlight,
+                    Processed = processed,
+                    Dropped = dropped,
+                    P50Milliseconds = latency.PercentileMilliseconds(50),
+                    P99Milliseconds = latency.PercentileMilliseconds(99)
+                };
+            }
+        }
+        
+        private void Pump()
+        {
+            while (true)
+            {
+                FrameJob job;
+                lock (queue)
+                {
+                    if (inFlight >= maxInFlight || queue.Count == 0)
+                    {
+                        return;
+                    }
+                    job = queue.Dequeue();
+                    inFlight++;
+                }
+                _ = Run(job);
+            }
+        }
+        
+        private async Task Run(FrameJob job)
+        {
+            long start = Stopwatch.GetTimestamp();
+            PipelineStage next = null;
+            bool failed = false;
+            try
+            {
+                // Cancelled frames are finished without running the stage.
+                if (!job.Token.IsCancellationRequested)
+                {
+                    next = await work(job);
+                }
+            }
+            catch (OperationCanceledException) when (job.Token.IsCancellationRequested)
+            {
+                next = null;
+            }
+            catch (Exception ex)
+            {
+                failed = true;
+                Debug.LogError($"Error in vision processing ({name}): {ex.Message}");
+            }
+            
+            latency.Record(Stopwatch.GetTimestamp() - start);
+            lock (queue)
+            {
+                inFlight--;
+                processed++;
+            }
+            
+            if (next != null)
+            {
+                next.Post(job);
+            }
+            else
+            {
+                job.Complete(!failed && job.Result != null && !job.Token.IsCancellationRequested);
+            }
+            Pump();
+        }
+    }
+    
+    // Consecutive-failure circuit breaker. Once open, calls fail fast until
+    // openDuration has passed; then a single trial call is let through and
+    // its outcome closes or re-opens the circuit.
+    private sealed class CircuitBreaker
+    {
+        private enum State
+        {
+            Closed,
+            Open,
+            HalfOpen
+        }
+        
+        private readonly int failureThreshold;
+        private readonly TimeSpan openDuration;
+        private State state = State.Closed;
+        private int consecutiveFailures;
+        private DateTime openUntil;
+        
+        public CircuitBreaker(int failureThreshold, TimeSpan openDuration)
+        {
+            this.failureThreshold = Math.Max(1, failureThreshold);
+            this.openDuration = openDuration;
+        }
+        
+        // True while calls would be rejected, i.e. open and not yet due a trial.
+        public bool IsOpen
+        {
+            get
+            {
+                lock (this)
+                {
+                    return state == State.Open && DateTime.UtcNow < openUntil ||
+                        state == State.HalfOpen;
+                }
+            }
+        }
+        
+        public bool TryEnter()
+        {
+            lock (this)
+            {
+                switch (state)
+                {
+                    case State.Closed:
+                        return true;
+                    case State.Open when DateTime.UtcNow >= openUntil:
+                        state = State.HalfOpen;
+                        return true;
+                    default:
+                        return false;
+                }
+            }
+        }
+        
+        public void RecordSuccess()
+        {
+            lock (this)
+            {
+                state = State.Closed;
+                consecutiveFailures = 0;
+            }
+        }
+        
+        // A trial call cancelled by its caller says nothing about health; the
+        // next caller gets to try instead.
+        public void RecordAbandoned()
+        {
+            lock (this)
+            {
+                if (state == State.HalfOpen)
+                {
+                    state = State.Open;
+                    openUntil = DateTime.UtcNow;
+                }
+            }
+        }
+        
+        public void RecordFailure()
+        {
+            lock (this)
+            {
+                consecutiveFailures++;
+                if (state == State.HalfOpen || consecutiveFailures >= failureThreshold)
+                {
+                    if (state != State.Open)
+                    {
+                        Debug.LogWarning($"Vision backend unhealthy after {consecutiveFailures} failures; pausing calls for {openDuration.TotalSeconds:F0} s");
+                    }
+                    state = State.Open;
+                    openUntil = DateTime.UtcNow + openDuration;
+                }
+            }
+        }
+    }
+    
+    private sealed class CircuitOpenException : Exception
+    {
+        public CircuitOpenException()
+            : base("Vision backend circuit is open")
+        {
+        }
+    }
+    
+    public enum BudgetDecision
+    {
+        Granted,
+        Deferred,
+        Denied
+    }
+    
+    // Token buckets for the monthly quota. Each day's bucket is refilled with
+    // an equal share of what is left of the month, so unused days roll
+    // forward and a heavy first week cannot starve the rest. A per-second
+    // bucket sized from the per-minute rate limit smooths bursts and is
+    // emptied when the service reports throttling. State is written to a
+    // small text file after every change so restarts do not reset the count.
+    // Writes happen on a worker, and changes made while one is in progress
+    // collapse into a single follow-up write, so the main thread never
+    // touches the disk. Callers that are about to send a granted call await
+    // WhenSaved first. A refund lost to a crash only overstates what was
+    // used, and a lost day roll is redone on load.
+    private sealed class BudgetScheduler
+    {
+        private static readonly Task<bool> NothingToSave = Task.FromResult(true);
+        
+        private readonly int monthlyLimit;
+        private readonly double tokensPerSecond;
+        private readonly double burst;
+        private readonly float lowNoveltyReserve;
+        private readonly string path;
+        private readonly Func<DateTime> clock;
+        
+        private DateTime month;
+        private DateTime day;
+        private int usedToday;
+        private int dailyAllowance;
+        private double rateTokens;
+        private DateTime lastRefill;
+        private DateTime pausedUntil;
+        
+        private readonly object saveLock = new object();
+        private string pendingLine;
+        private TaskCompletionSource<bool> pendingSaved;
+        private Task<bool> lastSaved = NothingToSave;
+        private bool writing;
+        
+        public int UsedThisMonth { get; private set; }
+        public int HedgesThisMonth { get; private set; }
+        public bool IsExhausted { get { Roll(); return UsedThisMonth >= monthlyLimit; } }
+        public int RemainingToday { get { Roll(); return Math.Max(0, dailyAllowance - usedToday); } }
+        
+        public BudgetScheduler(int monthlyLimit, int callsPerMinute, float lowNoveltyReserve, string path, Func<DateTime> clock)
+        {
+            this.monthlyLimit = monthlyLimit;
+            this.tokensPerSecond = Math.Max(1, callsPerMinute) / 60.0;
+            this.burst = Math.Max(1, callsPerMinute / 4);
+            this.lowNoveltyReserve = lowNoveltyReserve;
+            this.path = path;
+            this.clock = clock;
+            
+            DateTime now = clock();
+            rateTokens = burst;
+            lastRefill = now;
+            if (!TryLoad())
+            {
+                month = new DateTime(now.Year, now.Month, 1);
+                StartDay(now.Date);
+            }
+        }
+        
+        // Low-novelty frames are denied once today's bucket falls into the
+        // reserve, which shrinks as the day runs out so unclaimed calls still
+        // get used. Frames that pass the daily check but find the rate bucket
+        // empty are told how long to wait.
+        public BudgetDecision TryAcquire(float novelty, out TimeSpan wait)
+        {
+            wait = TimeSpan.Zero;
+            Roll();
+            
+            DateTime now = clock();
+            double dayLeft = 1 - now.TimeOfDay.TotalDays;
+            int remaining = dailyAllowance - usedToday;
+            if (UsedThisMonth >= monthlyLimit || remaining < 1 ||
+                remaining <= lowNoveltyReserve * (1f - novelty) * dailyAllowance * dayLeft)
+            {
+                return BudgetDecision.Denied;
+            }
+            
+            Refill(now);
+            if (now < pausedUntil || rateTokens < 1)
+            {
+                double seconds = Math.Max((pausedUntil - now).TotalSeconds, (1 - rateTokens) / tokensPerSecond);
+                wait = TimeSpan.FromSeconds(seconds);
+                return BudgetDecision.Deferred;
+            }
+            
+            rateTokens--;
+            usedToday++;
+            UsedThisMonth++;
+            Save();
+            return BudgetDecision.Granted;
+        }
+        
+        // A duplicate call bypasses the novelty reserve but never waits: if the
+        // day, the rate bucket or the month's hedge allowance is spent, the
+        // caller simply keeps waiting on the original.
+        public bool TryAcquireHedge(int maxHedgesPerMonth)
+        {
+            Roll();
+            DateTime now = clock();
+            Refill(now);
+            if (HedgesThisMonth >= maxHedgesPerMonth || UsedThisMonth >= monthlyLimit ||
+                usedToday >= dailyAllowance || now < pausedUntil || rateTokens < 1)
+            {
+                return false;
+            }
+            
+            rateTokens--;
+            usedToday++;
+            UsedThisMonth++;
+            HedgesThisMonth++;
+            Save();
+            return true;
+        }
+        
+        // Returns a transaction whose call failed before being billed.
+        public void Refund(bool hedge = false)
+        {
+            if (usedToday > 0) usedToday--;
+            if (UsedThisMonth > 0) UsedThisMonth--;
+            if (hedge && HedgesThisMonth > 0) HedgesThisMonth--;
+            Save();
+        }
+        
+        // Completes once every change made so far is on disk: true when it
+        // was written (or there is no state file), false if the write failed.
+        public Task<bool> WhenSaved()
+        {
+            lock (saveLock)
+            {
+                return lastSaved;
+            }
+        }
+        
+        public void Pause(TimeSpan retryAfter)
+        {
+            DateTime until = clock() + retryAfter;
+            if (until > pausedUntil)
+            {
+                pausedUntil = until;
+            }
+            rateTokens = 0;
+        }
+        
+        private void Refill(DateTime now)
+        {
+            double elapsed = (now - lastRefill).TotalSeconds;
+            if (elapsed > 0)
+            {
+                rateTokens = Math.Min(burst, rateTokens + elapsed * tokensPerSecond);
+                lastRefill = now;
+            }
+        }
+        
+        private void Roll()
+        {
+            DateTime today = clock().Date;
+            if (today == day)
+            {
+                return;
+            }
+            
+            var currentMonth = new DateTime(today.Year, today.Month, 1);
+            if (currentMonth != month)
+            {
+                month = currentMonth;
+                UsedThisMonth = 0;
+                HedgesThisMonth = 0;
+            }
+            StartDay(today);
+            Save();
+        }
+        
+        private void StartDay(DateTime today)
+        {
+            day = today;
+            usedToday = 0;
+            int daysLeft = DateTime.DaysInMonth(today.Year, today.Month) - today.Day + 1;
+            int remaining = Math.Max(0, monthlyLimit - UsedThisMonth);
+            dailyAllowance = (remaining + daysLeft - 1) / daysLeft;
+        }
+        
+        // Line format: month (yyyy-MM), used this month, day (yyyy-MM-dd),
+        // used today, today's allowance and, if present, hedges this month.
+        private bool TryLoad()
+        {
+            if (path == null || !File.Exists(path))
+            {
+                return false;
+            }
+            
+            try
+            {
+                string[] fields = File.ReadAllText(path).Split(new[] { ' ' }, StringSplitOptions.RemoveEmptyEntries);
+                month = DateTime.ParseExact(fields[0], "yyyy-MM", CultureInfo.InvariantCulture);
+                UsedThisMonth = int.Parse(fields[1], CultureInfo.InvariantCulture);
+                day = DateTime.ParseExact(fields[2], "yyyy-MM-dd", CultureInfo.InvariantCulture);
+                usedToday = int.Parse(fields[3], CultureInfo.InvariantCulture);
+                dailyAllowance = int.Parse(fields[4], CultureInfo.InvariantCulture);
+                HedgesThisMonth = fields.Length > 5 ? int.Parse(fields[5], CultureInfo.InvariantCulture) : 0;
+            }
+            catch (Exception ex) when (ex is FormatException || ex is IndexOutOfRangeException || ex is OverflowException)
+            {
+                Debug.LogWarning($"Ignoring unreadable budget state: {ex.Message}");
+                UsedThisMonth = 0;
+                return false;
+            }
+            
+            Roll();
+            return true;
+        }
+        
+        // Formats the state on the caller's thread and queues it for the
+        // writer, replacing any line still waiting.
+        private void Save()
+        {
+            if (path == null)
+            {
+                return;
+            }
+            
+            string line = string.Format(CultureInfo.InvariantCulture, "{0:yyyy-MM} {1} {2:yyyy-MM-dd} {3} {4} {5}",
+                month, UsedThisMonth, day, usedToday, dailyAllowance, HedgesThisMonth);
+            lock (saveLock)
+            {
+                pendingLine = line;
+                if (pendingSaved == null)
+                {
+                    pendingSaved = new TaskCompletionSource<bool>(TaskCreationOptions.RunContinuationsAsynchronously);
+                    lastSaved = pendingSaved.Task;
+                }
+                if (!writing)
+                {
+                    writing = true;
+                    Task.Run(WritePending);
+                }
+            }
+        }
+        
+        private void WritePending()
+        {
+            while (true)
+            {
+                string line;
+                TaskCompletionSource<bool> saved;
+                lock (saveLock)
+                {
+                    if (pendingLine == null)
+                    {
+                        writing = false;
+                        return;
+                    }
+                    line = pendingLine;
+                    saved = pendingSaved;
+                    pendingLine = null;
+                    pendingSaved = null;
+                }
+                
+                try
+                {
+                    string temporary = path + ".tmp";
+                    File.WriteAllText(temporary, line);
+                    if (File.Exists(path))
+                    {
+                        File.Replace(temporary, path, null);
+                    }
+                    else
+                    {
+                        File.Move(temporary, path);
+                    }
+                    saved.TrySetResult(true);
+                }
+                catch (Exception ex) when (ex is IOException || ex is UnauthorizedAccessException)
+                {
+                    Debug.LogWarning($"Failed to save budget state: {ex.Message}");
+                    saved.TrySetResult(false);
+                }
+            }
+        }
+    }
+    
+    // Collects cache-missing frames for a short window and submits them as one
+    // mosaic image. Each frame is downscaled into its own tile; returned
+    // objects are assigned to the tile holding their centre and mapped back to
+    // that frame's capture coordinates. Batches flush when full or when the
+    // window started by their first frame elapses.
+    private class MosaicBatcher
+    {
+        // Each entry holds its own reference to the frame, because a
+        // cancelled job completes and releases its frame while the batch
+        // still has to downscale it.
+        private class Entry
+        {
+            public FrameBuffer Frame;
+            public Resolution Resolution;
+            public float Novelty;
+            public TaskCompletionSource<ImageAnalysis> Completion;
+            public CancellationTokenRegistration Registration;
+        }
+        
+        private readonly int maxFrames;
+        private readonly TimeSpan window;
+        private readonly int longEdge;
+        private readonly Func<FrameBuffer, float, Task<ImageAnalysis>> analyze;
+        private readonly Func<(UploadEncoding Encoding, int Quality)> encodingSettings;
+        private List<Entry> pending = new List<Entry>();
+        private int batchId;
+        
+        public MosaicBatcher(
+            int maxFrames,
+            TimeSpan window,
+            int longEdge,
+            Func<FrameBuffer, float, Task<ImageAnalysis>> analyze,
+            Func<(UploadEncoding, int)> encodingSettings)
+        {
+            this.maxFrames = Math.Max(1, maxFrames);
+            this.window = window;
+            this.longEdge = longEdge > 0 ? longEdge : 1280;
+            this.analyze = analyze;
+            this.encodingSettings = encodingSettings;
+        }
+        
+        public LatencyRecorder[] LatencyByBatchSize { get; } = CreateRecorders();
+        
+        public Task<ImageAnalysis> Analyze(FrameJob job)
+        {
+            var entry = new Entry
+            {
+                Frame = job.Frame.AddRef(),
+                Resolution = job.Resolution,
+                Novelty = job.Novelty,
+                Completion = new TaskCompletionSource<ImageAnalysis>(TaskCreationOptions.RunContinuationsAsynchronously)
+            };
+            
+            // The batch is shared, so a cancelled frame stops waiting but its tile is still sent.
+            entry.Registration = job.Token.Register(() => entry.Completion.TrySetCanceled());
+            
+            lock (this)
+            {
+                pending.Add(entry);
+                if (pending.Count >= maxFrames)
+                {
+                    Flush();
+                }
+                else if (pending.Count == 1)
+                {
+                    _ = FlushAfterWindow(batchId);
+                }
+            }
+            return entry.Completion.Task;
+        }
+        
+        private async Task FlushAfterWindow(int id)
+        {
+            await Task.Delay(window);
+            lock (this)
+            {
+                if (id == batchId && pending.Count > 0)
+                {
+                    Flush();
+                }
+            }
+        }
+        
+        private void Flush()
+        {
+            var batch = pending;
+            pending = new List<Entry>();
+            batchId++;
+            _ = Submit(batch);
+        }
+        
+        private async Task Submit(List<Entry> batch)
+        {
+            long start = Stopwatch.GetTimestamp();
+            try
+            {
+                var (encoding, quality) = encodingSettings();
+                int gridEdge = (int)Math.Ceiling(Math.Sqrt(batch.Count));
+                var first = batch[0].Resolution;
+                int tileWidth = Math.Max(1, longEdge / gridEdge);
+                int tileHeight = Math.Max(1, first.width > 0 ? tileWidth * first.height / first.width : tileWidth);
+                var tiles = LayoutMosaic(batch.Count, tileWidth, tileHeight, out int mosaicWidth, out int mosaicHeight);
+                for (int i = 0; i < batch.Count; i++)
+                {
+                    tiles[i].SourceWidth = batch[i].Resolution.width;
+                    tiles[i].SourceHeight = batch[i].Resolution.height;
+                }
+                
+                FrameBuffer upload = await RunOnWorker(() =>
+                {
+                    var mosaic = FrameBuffer.Rent(mosaicWidth * mosaicHeight * 4);
+                    try
+                    {
+                        Array.Clear(mosaic.Array, 0, mosaic.Length);
+                        for (int i = 0; i < batch.Count; i++)
+                        {
+                            var entry = batch[i];
+                            if (entry.Frame.Length != entry.Resolution.width * entry.Resolution.height * 4) continue;
+                            DownscaleBgra32(entry.Frame.Span, entry.Resolution.width, entry.Resolution.height,
+                                mosaic.Array, tileWidth, tileHeight, mosaicWidth, tiles[i].PackedY * mosaicWidth + tiles[i].PackedX);
+                        }
+                        return FrameBuffer.Wrap(EncodeBgra32(mosaic.Array, mosaicWidth, mosaicHeight, encoding, quality));
+                    }
+                    finally
+                    {
+                        mosaic.Release();
+                        ReleaseFrames(batch);
+                    }
+                });
+                
+                // The mosaic is worth as much to the budget as its most novel frame.
+                var analysis = await analyze(upload, batch.Max(entry => entry.Novelty));
+                if (analysis == null)
+                {
+                    foreach (var entry in batch)
+                    {
+                        entry.Completion.TrySetResult(null);
+                    }
+                    return;
+                }
+                
+                var perFrame = SplitMosaicObjects(analysis.Objects, tiles);
+                
+                LatencyByBatchSize[Math.Min(batch.Count, LatencyByBatchSize.Length - 1)]
+                    .Record(Stopwatch.GetTimestamp() - start);
+                for (int i = 0; i < batch.Count; i++)
+                {
+                    // Tags describe the whole mosaic and cannot be attributed to one frame.
+                    batch[i].Completion.TrySetResult(new ImageAnalysis { Objects = perFrame[i], Tags = new List<ImageTag>() });
+                }
+            }
+            catch (Exception ex)
+            {
+                foreach (var entry in batch)
+                {
+                    entry.Completion.TrySetException(ex);
+                }
+            }
+            finally
+            {
+                // Covers a failure before the encode worker ran.
+                ReleaseFrames(batch);
+                foreach (var entry in batch)
+                {
+                    entry.Registration.Dispose();
+                }
+            }
+        }
+        
+        private static void ReleaseFrames(List<Entry> batch)
+        {
+            foreach (var entry in batch)
+            {
+                entry.Frame?.Release();
+                entry.Frame = null;
+            }
+        }
+        
+        private static LatencyRecorder[] CreateRecorders()
+        {
+            var recorders = new LatencyRecorder[17];
+            for (int i = 0; i < recorders.Length; i++)
+            {
+                recorders[i] = new LatencyRecorder(256);
+            }
+            return recorders;
+        }
+    }
+    
+    // Latency from batch submission to per-frame results, in milliseconds,
+    // for each batch size seen so far.
+    public IReadOnlyDictionary<int, (double P50Milliseconds, double P99Milliseconds)> GetMosaicLatencyBySize()
+    {
+        var curve = new Dictionary<int, (double, double)>();
+        if (mosaicBatcher == null)
+        {
+            return curve;
+        }
+        
+        var recorders = mosaicBatcher.LatencyByBatchSize;
+        for (int size = 1; size < recorders.Length; size++)
+        {
+            if (recorders[size].Count > 0)
+            {
+                curve[size] = (recorders[size].PercentileMilliseconds(50), recorders[size].PercentileMilliseconds(99));
+            }
+        }
+        return curve;
+    }
+    
+    // Minimal int8 CNN runtime for a tiny single-shot detector. The model
+    // file holds CHW int8 weights with int32 biases and a per-layer float
+    // requantization scale; activations stay int8 between layers and
+    // accumulate in int32. The last layer is a YOLO-style head producing, per
+    // grid cell, objectness, box (x, y, w, h) and class logits.
+    //
+    // File layout (little endian):
+    //   uint magic "TDQ1", int inputWidth, int inputHeight, int inputChannels,
+    //   float outputScale, int labelCount, string[labelCount] labels,
+    //   int layerCount, then per layer:
+    //     byte kind (0 = conv, 1 = maxpool 2x2)
+    //     conv: int outChannels, int kernel, int stride, bool relu,
+    //           float scale, int[outChannels] bias,
+    //           sbyte[outChannels * inChannels * kernel * kernel] weights
+    private class Int8Detector
+    {
+        private const uint MODEL_MAGIC = 0x31514454; // "TDQ1"
+        private const float NOISE_FLOOR = 0.25f;
+        private const float NMS_IOU = 0.45f;
+        
+        private class Layer
+        {
+            public bool IsPool;
+            public int InChannels;
+            public int OutChannels;
+            public int Kernel;
+            public int Stride;
+            public bool Relu;
+            public float Scale;
+            public int[] Bias;
+            public sbyte[] Weights;
+        }
+        
+        private readonly List<Layer> layers = new List<Layer>();
+        private string[] labels;
+        private int inputWidth;
+        private int inputHeight;
+        private int inputChannels;
+        private float outputScale;
+        
+        [ThreadStatic] private static byte[] inputPixels;
+        
+        public static Int8Detector Load(string path)
+        {
+            var detector = new Int8Detector();
+            using (var reader = new BinaryReader(File.OpenRead(path)))
+            {
+                if (reader.ReadUInt32() != MODEL_MAGIC)
+                {
+                    throw new InvalidDataException("Not a local detector model");
+                }
+                
+                detector.inputWidth = reader.ReadInt32();
+                detector.inputHeight = reader.ReadInt32();
+                detector.inputChannels = reader.ReadInt32();
+                detector.outputScale = reader.ReadSingle();
+                detector.labels = new string[reader.ReadInt32()];
+                for (int i = 0; i < detector.labels.Length; i++)
+                {
+                    detector.labels[i] = reader.ReadString();
+                }
+                
+                int channels = detector.inputChannels;
+                int layerCount = reader.ReadInt32();
+                for (int i = 0; i < layerCount; i++)
+                {
+                    var layer = new Layer { InChannels = channels, IsPool = reader.ReadByte() == 1 };
+                    if (layer.IsPool)
+                    {
+                        layer.OutChannels = channels;
+                    }
+                    else
+                    {
+                        layer.OutChannels = reader.ReadInt32();
+                        layer.Kernel = reader.ReadInt32();
+                        layer.Stride = reader.ReadInt32();
+                        layer.Relu = reader.ReadBoolean();
+                        layer.Scale = reader.ReadSingle();
+                        layer.Bias = new int[layer.OutChannels];
+                        for (int c = 0; c < layer.OutChannels; c++)
+                        {
+                            layer.Bias[c] = reader.ReadInt32();
+                        }
+                        
+                        int weightCount = layer.OutChannels * channels * layer.Kernel * layer.Kernel;
+                        byte[] raw = reader.ReadBytes(weightCount);
+                        if (raw.Length != weightCount)
+                        {
+                            throw new EndOfStreamException("Truncated local detector weights");
+                        }
+                        layer.Weights = new sbyte[weightCount];
+                        Buffer.BlockCopy(raw, 0, layer.Weights, 0, weightCount);
+                    }
+                    
+                    detector.layers.Add(layer);
+                    channels = layer.OutChannels;
+                }
+                
+                if (channels != 5 + detector.labels.Length)
+                {
+                    throw new InvalidDataException("Detector head does not match label count");
+                }
+            }
+            return detector;
+        }
+        
+        public List<DetectedObject> Detect(ReadOnlySpan<byte> frame, int frameWidth, int frameHeight)
+        {
+            var detections = new List<DetectedObject>();
+            if (frame.Length != frameWidth * frameHeight * 4)
+            {
+                return detections;
+            }
+            
+            int pixelBytes = inputWidth * inputHeight * 4;
+            if (inputPixels == null || inputPixels.Length < pixelBytes)
+            {
+                inputPixels = new byte[pixelBytes];
+            }
+            DownscaleBgra32(frame, frameWidth, frameHeight, inputPixels, inputWidth, inputHeight);
+            
+            // Quantize to int8 around zero, as RGB planes or a single luma plane.
+            int width = inputWidth;
+            int height = inputHeight;
+            int plane = width * height;
+            var activations = new sbyte[plane * inputChannels];
+            for (int i = 0; i < plane; i++)
+            {
+                int b = inputPixels[i * 4];
+                int g = inputPixels[i * 4 + 1];
+                int r = inputPixels[i * 4 + 2];
+                if (inputChannels == 1)
+                {
+                    activations[i] = (sbyte)(((r * 77 + g * 150 + b * 29) >> 8) - 128);
+                }
+                else
+                {
+                    activations[i] = (sbyte)(r - 128);
+                    activations[plane + i] = (sbyte)(g - 128);
+                    activations[2 * plane + i] = (sbyte)(b - 128);
+                }
+            }
+            
+            foreach (var layer in layers)
+            {
+                activations = layer.IsPool
+                    ? MaxPool(activations, layer.InChannels, ref width, ref height)
+                    : Convolve(activations, layer, ref width, ref height);
+            }
+            
+            Decode(activations, width, height, frameWidth, frameHeight, detections);
+            return detections;
+        }
+        
+        private static sbyte[] Convolve(sbyte[] input, Layer layer, ref int width, ref int height)
+        {
+            int kernel = layer.Kernel;
+            int pad = kernel / 2;
+            int outWidth = (width + 2 * pad - kernel) / layer.Stride + 1;
+            int outHeight = (height + 2 * pad - kernel) / layer.Stride + 1;
+            int inPlane = width * height;
+            var output = new sbyte[layer.OutChannels * outWidth * outHeight];
+            
+            for (int oc = 0; oc < layer.OutChannels; oc++)
+            {
+                int weightBase = oc * layer.InChannels * kernel * kernel;
+                for (int oy = 0; oy < outHeight; oy++)
+                {
+                    for (int ox = 0; ox < outWidth; ox++)
+                    {
+                        int acc = layer.Bias[oc];
+                        int iy0 = oy * layer.Stride - pad;
+                        int ix0 = ox * layer.Stride - pad;
+                        
+                        for (int ic = 0; ic < layer.InChannels; ic++)
+                        {
+                            int inBase = ic * inPlane;
+                            int w = weightBase + ic * kernel * kernel;
+                            for (int ky = 0; ky < kernel; ky++, w += kernel)
+                            {
+                                int iy = iy0 + ky;
+                                if ((uint)iy >= (uint)height) continue;
+                                int row = inBase + iy * width;
+                                for (int kx = 0; kx < kernel; kx++)
+                                {
+                                    int ix = ix0 + kx;
+                                    if ((uint)ix >= (uint)width) continue;
+                                    acc += input[row + ix] * layer.Weights[w + kx];
+                                }
+                            }
+                        }
+                        
+                        int value = (int)Math.Round(acc * layer.Scale);
+                        if (layer.Relu && value < 0) value = 0;
+                        output[(oc * outHeight + oy) * outWidth + ox] = (sbyte)Math.Max(-128, Math.Min(127, value));
+                    }
+                }
+            }
+            
+            width = outWidth;
+            height = outHeight;
+            return output;
+        }
+        
+        private static sbyte[] MaxPool(sbyte[] input, int channels, ref int width, ref int height)
+        {
+            int outWidth = width / 2;
+            int outHeight = height / 2;
+            var output = new sbyte[channels * outWidth * outHeight];
+            for (int c = 0; c < channels; c++)
+            {
+                int inBase = c * width * height;
+                for (int oy = 0; oy < outHeight; oy++)
+                {
+                    for (int ox = 0; ox < outWidth; ox++)
+                    {
+                        int i = inBase + oy * 2 * width + ox * 2;
+                        sbyte max = Math.Max(Math.Max(input[i], input[i + 1]), Math.Max(input[i + width], input[i + width + 1]));
+                        output[(c * outHeight + oy) * outWidth + ox] = max;
+                    }
+                }
+            }
+            width = outWidth;
+            height = outHeight;
+            return output;
+        }
+        
+        private void Decode(sbyte[] head, int gridWidth, int gridHeight, int frameWidth, int frameHeight, List<DetectedObject> detections)
+        {
+            int plane = gridWidth * gridHeight;
+            var candidates = new List<(int Label, float Confidence, float X, float Y, float W, float H)>();
+            
+            for (int gy = 0; gy < gridHeight; gy++)
+            {
+                for (int gx = 0; gx < gridWidth; gx++)
+                {
+                    int cell = gy * gridWidth + gx;
+                    float objectness = Sigmoid(head[cell] * outputScale);
+                    if (objectness < NOISE_FLOOR) continue;
+                    
+                    int bestLabel = 0;
+                    float bestLogit = float.MinValue;
+                    float sum = 0;
+                    for (int l = 0; l < labels.Length; l++)
+                    {
+                        float logit = head[(5 + l) * plane + cell] * outputScale;
+                        if (logit > bestLogit)
+                        {
+                            bestLogit = logit;
+                            bestLabel = l;
+                        }
+                    }
+                    for (int l = 0; l < labels.Length; l++)
+                    {
+                        sum += (float)Math.Exp(head[(5 + l) * plane + cell] * outputScale - bestLogit);
+                    }
+                    
+                    float confidence = objectness / sum;
+                    if (confidence < NOISE_FLOOR) continue;
+                    
+                    float w = Sigmoid(head[3 * plane + cell] * outputScale);
+                    float h = Sigmoid(head[4 * plane + cell] * outputScale);
+                    float cx = (gx + Sigmoid(head[plane + cell] * outputScale)) / gridWidth;
+                    float cy = (gy + Sigmoid(head[2 * plane + cell] * outputScale)) / gridHeight;
+                    candidates.Add((bestLabel, confidence, cx - w / 2, cy - h / 2, w, h));
+                }
+            }
+            
+            // Greedy per-label non-maximum suppression.
+            candidates.Sort((a, b) => b.Confidence.CompareTo(a.Confidence));
+            var kept = new List<(int Label, float Confidence, float X, float Y, float W, float H)>();
+            foreach (var candidate in candidates)
+            {
+                bool suppressed = false;
+                foreach (var other in kept)
+                {
+                    if (other.Label == candidate.Label && IntersectionOverUnion(other, candidate) > NMS_IOU)
+                    {
+                        suppressed = true;
+                        break;
+                    }
+                }
+                
+                if (!suppressed)
+                {
+                    kept.Add(candidate);
+                    detections.Add(new DetectedObject
+                    {
+                        ObjectProperty = labels[candidate.Label],
+                        Confidence = candidate.Confidence,
+                        Rectangle = new BoundingRect
+                        {
+                            X = (int)(candidate.X * frameWidth),
+                            Y = (int)(candidate.Y * frameHeight),
+                            W = (int)(candidate.W * frameWidth),
+                            H = (int)(candidate.H * frameHeight)
+                        }
+                    });
+                }
+            }
+        }
+        
+        private static float IntersectionOverUnion(
+            (int Label, float Confidence, float X, float Y, float W, float H) a,
+            (int Label, float Confidence, float X, float Y, float W, float H) b)
+        {
+            float iw = Math.Min(a.X + a.W, b.X + b.W) - Math.Max(a.X, b.X);
+            float ih = Math.Min(a.Y + a.H, b.Y + b.H) - Math.Max(a.Y, b.Y);
+            if (iw <= 0 || ih <= 0) return 0;
+            float intersection = iw * ih;
+            return intersection / (a.W * a.H + b.W * b.H - intersection);
+        }
+        
+        private static float Sigmoid(float x)
+        {
+            return 1f / (1f + (float)Math.Exp(-x));
+        }
+    }
+    
+    public interface IVisionBackend : IDisposable
+    {
+        Task ProbeAsync(CancellationToken cancellationToken);
+        
+        Task<ImageAnalysis> AnalyzeAsync(
+            Stream image,
+            IList<VisualFeatureTypes?> features,
+            CancellationToken cancellationToken);
+    }
+    
+    // Raised by backends when the service answers 429/503, carrying the
+    // Retry-After hint when one was sent.
+    public class VisionThrottledException : Exception
+    {
+        public TimeSpan? RetryAfter { get; }
+        
+        public VisionThrottledException(string message, TimeSpan? retryAfter)
+            : base(message)
+        {
+            RetryAfter = retryAfter;
+        }
+    }
+    
+    private class AzureVisionBackend : IVisionBackend
+    {
+        private readonly ComputerVisionClient client;
+        
+        public AzureVisionBackend(ComputerVisionClient client)
+        {
+            this.client = client;
+        }
+        
+        public async Task ProbeAsync(CancellationToken cancellationToken)
+        {
+            await client.ListModelsAsync(cancellationToken);
+        }
+        
+        public async Task<ImageAnalysis> AnalyzeAsync(
+            Stream image,
+            IList<VisualFeatureTypes?> features,
+            CancellationToken cancellationToken)
+        {
+            try
+            {
+                return await client.AnalyzeImageInStreamAsync(image, features, cancellationToken: cancellationToken);
+            }
+            catch (ComputerVisionErrorResponseException ex) when (
+                ex.Response != null &&
+                ((int)ex.Response.StatusCode == 429 || (int)ex.Response.StatusCode == 503))
+            {
+                throw new VisionThrottledException(ex.Message, ParseRetryAfter(ex.Response.Headers));
+            }
+        }
+        
+        private static TimeSpan? ParseRetryAfter(IDictionary<string, IEnumerable<string>> headers)
+        {
+            if (headers != null &&
+                headers.TryGetValue("Retry-After", out var values) &&
+                int.TryParse(values.FirstOrDefault(), out int seconds))
+            {
+                return TimeSpan.FromSeconds(seconds);
+            }
+            return null;
+        }
+        
+        public void Dispose()
+        {
+            client.Dispose();
+        }
+    }
+    
+    // Local stand-in for the Azure service. Latency follows a base + jitter
+    // distribution with an optional long tail, and each call can fail with an
+    // injected IOException, timeout or 429 throttle, or with a connection
+    // failure before anything is sent (not counted in CallCount). Detections are derived
+    // deterministically from the image bytes so identical frames agree.
+    public class MockVisionBackend : IVisionBackend
+    {
+        private static readonly string[] objectNames = { "chair", "table", "person", "laptop", "cup", "door", "plant", "monitor" };
+        
+        private readonly System.Random random;
+        
+        public TimeSpan BaseLatency { get; set; } = TimeSpan.FromMilliseconds(300);
+        public TimeSpan LatencyJitter { get; set; } = TimeSpan.FromMilliseconds(100);
+        public double TailProbability { get; set; } = 0.0;
+        public TimeSpan TailLatency { get; set; } = TimeSpan.FromSeconds(2);
+        public double ErrorRate { get; set; } = 0.0;
+        public double TimeoutRate { get; set; } = 0.0;
+        public TimeSpan Timeout { get; set; } = TimeSpan.FromSeconds(5);
+        public double ThrottleRate { get; set; } = 0.0;
+        public TimeSpan RetryAfter { get; set; } = TimeSpan.FromSeconds(1);
+        public double ConnectFailureRate { get; set; } = 0.0;
+        
+        public int CallCount => callCount;
+        private int callCount;
+        
+        public MockVisionBackend(int seed = 0)
+        {
+            random = new System.Random(seed);
+        }
+        
+        public Task ProbeAsync(CancellationToken cancellationToken)
+        {
+            return Task.Delay(BaseLatency, cancellationToken);
+        }
+        
+        public async Task<ImageAnalysis> AnalyzeAsync(
+            Stream image,
+            IList<VisualFeatureTypes?> features,
+            CancellationToken cancellationToken)
+        {
+            double roll, latencyRoll, tailRoll, connectRoll;
+            lock (random)
+            {
+                roll = random.NextDouble();
+                latencyRoll = random.NextDouble();
+                tailRoll = random.NextDouble();
+                connectRoll = random.NextDouble();
+            }
+            
+            if (connectRoll < ConnectFailureRate)
+            {
+                await Task.Yield();
+                throw new HttpRequestException("Mock backend unreachable", new SocketException((int)SocketError.ConnectionRefused));
+            }
+            Interlocked.Increment(ref callCount);
+            
+            if (roll < TimeoutRate)
+            {
+                await Task.Delay(Timeout, cancellationToken);
+                throw new TimeoutException("Mock backend timed out");
+            }
+            
+            var latency = BaseLatency + TimeSpan.FromTicks((long)(LatencyJitter.Ticks * latencyRoll));
+            if (tailRoll < TailProbability)
+            {
+                latency += TailLatency;
+            }
+            await Task.Delay(latency, cancellationToken);
+            
+            roll -= TimeoutRate;
+            if (roll < ThrottleRate)
+            {
+                throw new VisionThrottledException("Mock backend throttled (429)", RetryAfter);
+            }
+            
+            roll -= ThrottleRate;
+            if (roll < ErrorRate)
+            {
+                throw new IOException("Mock backend transient failure");
+            }
+            
+            return CreateAnalysis(image, features?.Contains(VisualFeatureTypes.Tags) == true);
+        }
+        
+        private static ImageAnalysis CreateAnalysis(Stream image, bool includeTags)
+        {
+            // Seed from a sparse sample of the image so equal frames yield equal results.
+            int seed = (int)image.Length;
+            var sample = new byte[4096];
+            int read = image.Read(sample, 0, sample.Length);
+            for (int i = 0; i < read; i += 16)
+            {
+                seed = seed * 31 + sample[i];
+            }
+            
+            var frameRandom = new System.Random(seed);
+            var objects = new List<DetectedObject>();
+            int count = frameRandom.Next(1, 5);
+            for (int i = 0; i < count; i++)
+            {
+                objects.Add(new DetectedObject
+                {
+                    ObjectProperty = objectNames[frameRandom.Next(objectNames.Length)],
+                    Confidence = 0.5 + frameRandom.NextDouble() * 0.5,
+                    Parent = frameRandom.Next(2) == 0 ? null : new ObjectHierarchy
+                    {
+                        ObjectProperty = "indoor object",
+                        Confidence = 0.4 + frameRandom.NextDouble() * 0.5
+                    },
+                    Rectangle = new BoundingRect
+                    {
+                        X = frameRandom.Next(0, 800),
+                        Y = frameRandom.Next(0, 600),
+                        W = frameRandom.Next(20, 400),
+                        H = frameRandom.Next(20, 400)
+                    }
+                });
+            }
+            
+            var tags = new List<ImageTag>();
+            if (includeTags)
+            {
+                tags.Add(new ImageTag { Name = "indoor", Confidence = 0.9 + frameRandom.NextDouble() * 0.1 });
+                foreach (var obj in objects)
+                {
+                    tags.Add(new ImageTag { Name = obj.ObjectProperty, Confidence = obj.Confidence });
+                }
+            }
+            
+            return new ImageAnalysis { Objects = objects, Tags = tags };
+        }
+        
+        public void Dispose()
+        {
+        }
+    }
+    
+    // Fixed-capacity latency sample buffer in Stopwatch ticks. Once full it
+    // keeps the most recent samples, so percentiles track current behaviour.
+    private class LatencyRecorder
+    {
+        private readonly long[] samples;
+        private int count;
+        private int next;
+        
+        public LatencyRecorder(int capacity)
+        {
+            samples = new long[Math.Max(1, capacity)];
+        }
+        
+        public int Count => count;
+        
+        public void Record(long elapsedTicks)
+        {
+            lock (samples)
+            {
+                samples[next] = elapsedTicks;
+                next = (next + 1) % samples.Length;
+                if (count < samples.Length) count++;
+            }
+        }
+        
+        public double PercentileMilliseconds(double percentile)
+        {
+            long[] sorted;
+            lock (samples)
+            {
+                if (count == 0) return 0;
+                sorted = new long[count];
+                Array.Copy(samples, sorted, count);
+            }
+            
+            Array.Sort(sorted);
+            int rank = (int)Math.Ceiling(percentile / 100.0 * sorted.Length) - 1;
+            return sorted[Math.Max(0, Math.Min(sorted.Length - 1, rank))] * 1000.0 / Stopwatch.Frequency;
+        }
+    }
+    
+    // Where the locatable camera was when a frame was taken. Frames without
+    // location data carry the default, invalid pose.
+    public struct CameraPose
+    {
+        public Matrix4x4 CameraToWorld;
+        public Matrix4x4 Projection;
+        public bool IsValid;
+
+        public CameraPose(Matrix4x4 cameraToWorld, Matrix4x4 projection)
+        {
+            CameraToWorld = cameraToWorld;
+            Projection = projection;
+            IsValid = true;
+        }
+    }
+
+    public struct RaycastBenchmarkReport
+    {
+        public int Triangles { get; set; }
+        public int Rays { get; set; }
+        public int MeshHits { get; set; }
+        public double Seconds { get; set; }
+        public double RaysPerSecond => Seconds > 0 ? Rays / Seconds : 0;
+        public double MicrosecondsPerRay => Rays > 0 ? Seconds * 1e6 / Rays : 0;
+
+        public override string ToString()
+        {
+            return $"{Rays} rays over {Triangles} triangles, {MeshHits} hits, " +
+                $"{RaysPerSecond:F0} rays/s, {MicrosecondsPerRay:F2} us/ray";
+        }
+    }
+
+    // A camera resolution and the pixel format frames are delivered in.
+    public struct CaptureProfile
+    {
+        public int Width;
+        public int Height;
+        public CapturePixelFormat Format;
+        
+        public CaptureProfile(int width, int height, CapturePixelFormat format)
+        {
+            Width = width;
+            Height = height;
+            Format = format;
+        }
+        
+        public override string ToString()
+        {
+            return $"{Width}x{Height} {Format}";
+        }
+    }
+    
+    public struct CaptureProfileReport
+    {
+        public CaptureProfile Profile { get; set; }
+        public int Frames { get; set; }
+        public double PrepareMilliseconds { get; set; }
+        public double EncodeMilliseconds { get; set; }
+        public double P50Milliseconds { get; set; }
+        public double P99Milliseconds { get; set; }
+        public long UploadBytesPerFrame { get; set; }
+        public double MeanConfidence { get; set; }
+        public double DetectionsPerFrame { get; set; }
+        
+        public override string ToString()
+        {
+            return $"{Profile}: prepare {PrepareMilliseconds:F2} ms, encode {EncodeMilliseconds:F2} ms, end to end p50 {P50Milliseconds:F1} ms, " +
+                $"p99 {P99Milliseconds:F1} ms, {UploadBytesPerFrame} B/upload, confidence {MeanConfidence:F3}, {DetectionsPerFrame:F1} detections/frame";
+        }
+    }
+    
+    public struct UploadEncodingReport
+    {
+        public int Width { get; set; }
+        public int Height { get; set; }
+        public int Quality { get; set; }
+        public int Frames { get; set; }
+        public long BytesPerUpload { get; set; }
+        public double EncodeMilliseconds { get; set; }
+        
+        // Mean DetectionAgreement with the full-resolution PNG upload, 0 to 1.
+        public double Agreement { get; set; }
+        
+        public override string ToString()
+        {
+            return $"{Width}x{Height} JPEG q{Quality}: {BytesPerUpload} B/upload, encode {EncodeMilliseconds:F2} ms, " +
+                $"agreement {Agreement:F3} over {Frames} frames";
+        }
+    }
+    
+    public struct CaptureReport
+    {
+        public int Frames { get; set; }
+        public bool VideoMode { get; set; }
+        public double P50Milliseconds { get; set; }
+        public double P99Milliseconds { get; set; }
+        public double FramesPerSecond { get; set; }
+        public long SkippedFrames { get; set; }
+        
+        public override string ToString()
+        {
+            return $"{(VideoMode ? "video" : "photo")} mode: {Frames} frames, capture-to-available p50 {P50Milliseconds:F1} ms, " +
+                $"p99 {P99Milliseconds:F1} ms, {FramesPerSecond:F1} fps, {SkippedFrames} stream frames skipped";
+        }
+    }
+
+    public struct TrackerReport
+    {
+        public int Frames { get; set; }
+        public int AnalysisCalls { get; set; }
+        public double CallReduction => Frames > 0 ? 1 - (double)AnalysisCalls / Frames : 0;
+        public double MeanDriftPixels { get; set; }
+        public double MaxDriftPixels { get; set; }
+        public double MicrosecondsPerFrame { get; set; }
+        
+        public override string ToString()
+        {
+            return $"{Frames} frames, {AnalysisCalls} analyses ({CallReduction:P0} fewer calls), drift mean {MeanDriftPixels:F1} px, " +
+                $"max {MaxDriftPixels:F1} px, tracker {MicrosecondsPerFrame:F0} us/frame";
+        }
+    }
+
+    public struct PerceptualKeyBenchmarkReport
+    {
+        public int Frames { get; set; }
+        public int IndexEntries { get; set; }
+        public int ExactHits { get; set; }
+        public int PerceptualHits { get; set; }
+        public int NearDuplicateHits { get; set; }
+        public int ExactCalls => Frames - ExactHits;
+        public int PerceptualCalls => Frames - PerceptualHits;
+        public int CallsSaved => ExactCalls - PerceptualCalls;
+        public double ExactHitRate => Frames > 0 ? (double)ExactHits / Frames : 0;
+        public double PerceptualHitRate => Frames > 0 ? (double)PerceptualHits / Frames : 0;
+        public double ExactHashMicroseconds { get; set; }
+        public double PerceptualHashMicroseconds { get; set; }
+        public double LookupP50Microseconds { get; set; }
+        public double LookupP99Microseconds { get; set; }
+
+        public override string ToString()
+        {
+            return $"{Frames} frames: exact {ExactHitRate:P0} hits, {ExactCalls} calls ({ExactHashMicroseconds:F0} us/hash); " +
+                $"perceptual {PerceptualHitRate:P0} hits ({NearDuplicateHits} near), {PerceptualCalls} calls ({PerceptualHashMicroseconds:F0} us/hash), " +
+                $"{CallsSaved} calls saved; lookup over {IndexEntries} entries p50 {LookupP50Microseconds:F1} us, p99 {LookupP99Microseconds:F1} us";
+        }
+    }
+
+    public struct LocalDetectorBenchmarkReport
+    {
+        public int Frames { get; set; }
+        public int FramesWithDetections { get; set; }
+        public int ResolvedLocally { get; set; }
+        public int BilledCalls => Frames - ResolvedLocally;
+        public double CallReduction => Frames > 0 ? (double)ResolvedLocally / Frames : 0;
+        public double InferenceP50Milliseconds { get; set; }
+        public double InferenceP99Milliseconds { get; set; }
+        
+        public override string ToString()
+        {
+            return $"{Frames} frames: inference p50 {InferenceP50Milliseconds:F1} ms, p99 {InferenceP99Milliseconds:F1} ms; " +
+                $"{FramesWithDetections} with detections, {ResolvedLocally} resolved locally, " +
+                $"{BilledCalls} billed calls ({CallReduction:P0} fewer)";
+        }
+    }
+
+    public struct HashBenchmarkReport
+    {
+        public int FrameBytes { get; set; }
+        public int Frames { get; set; }
+        public double Sha256PerCallMilliseconds { get; set; }
+        public double Sha256Milliseconds { get; set; }
+        public double Murmur128Milliseconds { get; set; }
+        public double Sha256PerCallGigabytesPerSecond { get; set; }
+        public double Sha256GigabytesPerSecond { get; set; }
+        public double Murmur128GigabytesPerSecond { get; set; }
+
+        public override string ToString()
+        {
+            return $"{FrameBytes} B x {Frames} frames: SHA-256 new hasher {Sha256PerCallMilliseconds:F2} ms ({Sha256PerCallGigabytesPerSecond:F2} GB/s), " +
+                $"reused {Sha256Milliseconds:F2} ms ({Sha256GigabytesPerSecond:F2} GB/s), Murmur128 {Murmur128Milliseconds:F2} ms ({Murmur128GigabytesPerSecond:F2} GB/s)";
+        }
+    }
+
+    public struct CacheKeyBenchmarkReport
+    {
+        public int Entries { get; set; }
+        public int Lookups { get; set; }
+        public double StringInsertNanoseconds { get; set; }
+        public double BinaryInsertNanoseconds { get; set; }
+        public double StringLookupNanoseconds { get; set; }
+        public double BinaryLookupNanoseconds { get; set; }
+        public double StringBytesPerLookup { get; set; }
+        public double BinaryBytesPerLookup { get; set; }
+
+        public override string ToString()
+        {
+            return $"{Entries} entries: insert string {StringInsertNanoseconds:F0} ns, binary {BinaryInsertNanoseconds:F0} ns; " +
+                $"{Lookups} lookups: string {StringLookupNanoseconds:F0} ns ({StringBytesPerLookup:F0} B), binary {BinaryLookupNanoseconds:F0} ns ({BinaryBytesPerLookup:F0} B)";
+        }
+    }
+
+    public struct CacheExpiryBenchmarkReport
+    {
+        public int Entries { get; set; }
+        public int Calls { get; set; }
+        public double HeapMicroseconds { get; set; }
+        public double ScanMicroseconds { get; set; }
+        public long HeapBytesPerCall { get; set; }
+        public long ScanBytesPerCall { get; set; }
+
+        public override string ToString()
+        {
+            return $"{Entries} entries, {Calls} calls: heap {HeapMicroseconds:F2} us ({HeapBytesPerCall} B), " +
+                $"scan {ScanMicroseconds:F2} us ({ScanBytesPerCall} B) per call";
+        }
+    }
+
+    public struct PersistentCacheReport
+    {
+        public int Session { get; set; }
+        public int Lookups { get; set; }
+        public int Revisits { get; set; }
+        public int Hits { get; set; }
+        public double HitRate => Lookups > 0 ? (double)Hits / Lookups : 0;
+        public double RevisitHitRate => Revisits > 0 ? (double)Hits / Revisits : 0;
+        public long FileBytes { get; set; }
+        public double OpenMilliseconds { get; set; }
+        public double IndexMilliseconds { get; set; }
+        public double FirstHitMicroseconds { get; set; }
+        public double LookupP50Microseconds { get; set; }
+        public double LookupP99Microseconds { get; set; }
+
+        public override string ToString()
+        {
+            return $"session {Session}: {FileBytes} B file, open {OpenMilliseconds:F2} ms, indexed {IndexMilliseconds:F1} ms, " +
+                $"first hit {FirstHitMicroseconds:F0} us, p50 {LookupP50Microseconds:F1} us, p99 {LookupP99Microseconds:F1} us; " +
+                $"{Hits}/{Lookups} hits ({HitRate:P0}), {RevisitHitRate:P0} of revisits";
+        }
+    }
+
+    public struct CacheStressReport
+    {
+        public int Threads { get; set; }
+        public long Operations { get; set; }
+        public long Hits { get; set; }
+        public long Evictions { get; set; }
+        public long Expirations { get; set; }
+        public long Mismatches { get; set; }
+        public bool Consistent { get; set; }
+        public double Milliseconds { get; set; }
+
+        public override string ToString()
+        {
+            return $"{Threads} threads, {Operations} operations in {Milliseconds:F0} ms: {Hits} hits, {Evictions} evictions, {Expirations} expired, " +
+                $"{Mismatches} mismatched values, {(Consistent ? "consistent" : "CORRUPTED")}";
+        }
+    }
+
+    public struct CacheScalingReport
+    {
+        public int Threads { get; set; }
+        public int Shards { get; set; }
+        public double LookupsPerSecond { get; set; }
+
+        public override string ToString()
+        {
+            return $"{Shards} shard(s), {Threads} threads: {LookupsPerSecond / 1e6:F1} M lookups/s";
+        }
+    }
+
+    public struct LabelBenchmarkReport
+    {
+        public int Detections { get; set; }
+        public int Frames { get; set; }
+        public double MeanMilliseconds { get; set; }
+        public double P99Milliseconds { get; set; }
+        public long AllocatedBytesPerFrame { get; set; }
+        public int CreatedLabels { get; set; }
+        public int TextUpdates { get; set; }
+
+        public override string ToString()
+        {
+            return $"{Detections} detections x {Frames} frames: mean {MeanMilliseconds:F3} ms, p99 {P99Milliseconds:F3} ms, " +
+                $"{AllocatedBytesPerFrame} B/frame allocated, {CreatedLabels} labels created, {TextUpdates} text updates";
+        }
+    }
+
+    public struct ResultMemoryBenchmarkReport
+    {
+        public int Results { get; set; }
+        public int DetectionsPerResult { get; set; }
+        public double LegacyBytesPerEntry { get; set; }
+        public double CompactBytesPerEntry { get; set; }
+        public long CompactEstimatedBytes { get; set; }
+        public double LegacyIterationMilliseconds { get; set; }
+        public double CompactIterationMilliseconds { get; set; }
+
+        public override string ToString()
+        {
+            return $"{Results} results x {DetectionsPerResult} detections: retained {LegacyBytesPerEntry:F0} -> {CompactBytesPerEntry:F0} B/entry " +
+                $"(estimate {CompactEstimatedBytes} B), walk all {LegacyIterationMilliseconds:F3} -> {CompactIterationMilliseconds:F3} ms";
+        }
+    }
+
+    public struct LoadReport
+    {
+        public int Frames { get; }
+        public double P50Milliseconds { get; }
+        public double P99Milliseconds { get; }
+        public double FramesPerSecond { get; }
+        
+        // Bytes allocated process-wide per submitted frame with pooled
+        // buffers, and (with compareCopyPath, else 0) with pooling off.
+        public long AllocatedBytesPerFrame { get; set; }
+        public long CopyPathBytesPerFrame { get; set; }
+        public int Gen0Collections { get; set; }
+        
+        public LoadReport(int frames, double p50Milliseconds, double p99Milliseconds, TimeSpan elapsed)
+            : this()
+        {
+            Frames = frames;
+            P50Milliseconds = p50Milliseconds;
+            P99Milliseconds = p99Milliseconds;
+            FramesPerSecond = elapsed.TotalSeconds > 0 ? frames / elapsed.TotalSeconds : 0;
+        }
+        
+        public override string ToString()
+        {
+            string copyPath = CopyPathBytesPerFrame > 0 ? $" ({CopyPathBytesPerFrame} B/frame without pooling)" : "";
+            return $"{Frames} frames, p50 {P50Milliseconds:F1} ms, p99 {P99Milliseconds:F1} ms, {FramesPerSecond:F1} fps, " +
+                $"{AllocatedBytesPerFrame} B/frame allocated{copyPath}, {Gen0Collections} gen0 GCs";
+        }
+    }
+
+    public struct BudgetSimulationReport
+    {
+        public int MonthlyLimit { get; set; }
+        public int Used { get; set; }
+        public double Utilization => MonthlyLimit > 0 ? (double)Used / MonthlyLimit : 0;
+        public int NovelMisses { get; set; }
+        public int NovelServed { get; set; }
+        public int RepeatMisses { get; set; }
+        public int RepeatServed { get; set; }
+        public int Deferred { get; set; }
+        
+        // The same month under a first-come limit; 0 when it never ran out.
+        public int HardLimitNovelServed { get; set; }
+        public int HardLimitExhaustedDay { get; set; }
+        
+        public override string ToString()
+        {
+            return $"quota {Used}/{MonthlyLimit} ({Utilization:P0}), novel misses served {NovelServed}/{NovelMisses}, " +
+                $"repeats served {RepeatServed}/{RepeatMisses}, {Deferred} deferrals; hard limit: novel served " +
+                $"{HardLimitNovelServed}/{NovelMisses}, exhausted on day {HardLimitExhaustedDay}";
+        }
+    }
+
+    public void Dispose()
+    {
+        if (isDisposed)
+            return;
+
+        isDisposed = true;
+        
+        // Aborts remote calls, backoffs and worker tasks for every frame in flight.
+        lifetime.Cancel();
+        lock (activeJobs)
+        {
+            foreach (var job in activeJobs)
+            {
+                job.Cancel();
+            }
+        }
+        foreach (var stage in new[] { captureStage, sceneStage, trackStage, hashStage, lookupStage, localStage, encodeStage, analyzeStage, projectStage, labelStage })
+        {
+            stage?.Clear();
+        }
+        labels.Clear();
+        StopFrameStream();
+        CleanupCamera();
+        visionBackend?.Dispose();
+        persistentStore?.Dispose();
+    }
+
+    private void CleanupCamera()
+    {
+        if (photoCaptureObject != null)
+        {
+            photoCaptureObject.StopPhotoModeAsync(OnPhotoModeStopped);
+        }
+    }
+
+    private void OnPhotoModeStopped(PhotoCapture.PhotoCaptureResult result)
+    {
+        photoCaptureObject.Dispose();
+        photoCaptureObject = null;
+    }
+
+    private void OnDestroy()
+    {
+        Dispose();
+    }
+
+    // Unity only exposes the photo through CopyRawImageDataIntoBuffer, so the
+    // pixels are copied once into a reused scratch list and once into a
+    // pooled FrameBuffer; every later stage shares that buffer. A photo taken
+    // while the profile was switching, whose size does not match the
+    // resolution photo mode now runs at, fails like any other capture.
+    private Task<(FrameBuffer Frame, CameraPose Pose, Resolution Resolution)> CaptureImage()
+    {
+        if (photoCaptureObject == null)
+        {
+            throw new InvalidOperationException("Camera is not initialized");
+        }
+        
+        var completion = new TaskCompletionSource<(FrameBuffer Frame, CameraPose Pose, Resolution Resolution)>();
+        long requestedAt = Stopwatch.GetTimestamp();
+        photoCaptureObject.TakePhotoAsync((result, photoFrame) =>
+        {
+            using (photoFrame)
+            {
+                if (!result.success)
+                {
+                    completion.SetException(new IOException("Photo capture failed"));
+                    return;
+                }
+                
+                captureScratch.Clear();
+                photoFrame.CopyRawImageDataIntoBuffer(captureScratch);
+                var resolution = cameraResolution;
+                if (captureScratch.Count != resolution.width * resolution.height * 4)
+                {
+                    completion.SetException(new IOException("Photo does not match the capture resolution"));
+                    return;
+                }
+                var buffer = FrameBuffer.Rent(captureScratch.Count);
+                captureScratch.CopyTo(0, buffer.Array, 0, captureScratch.Count);
+                
+                // The locatable camera reports where it was for this exact frame.
+                var pose = default(CameraPose);
+                if (photoFrame.hasLocationData &&
+                    photoFrame.TryGetCameraToWorldMatrix(out Matrix4x4 cameraToWorld) &&
+                    photoFrame.TryGetProjectionMatrix(out Matrix4x4 projection))
+                {
+                    pose = new CameraPose(cameraToWorld, projection);
+                }
+                captureLatency.Record(Stopwatch.GetTimestamp() - requestedAt);
+                completion.SetResult((buffer, pose, resolution));
+            }
+        });
+        return completion.Task;
     }
-}
\ No newline at end of file
+}